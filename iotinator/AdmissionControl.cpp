@@ -0,0 +1,119 @@
+/**
+ *  Admission control of the requests served by the iotinator master: rate limits and heap gate
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "AdmissionControl.h"
+
+TokenBucket::TokenBucket(uint16_t rate, uint16_t burst) {
+  _rate = rate;
+  _burst = burst;
+  _milliTokens = (uint32_t)burst * 1000;
+  _lastRefill = millis();
+}
+
+bool TokenBucket::take() {
+  _refill();
+  if(_milliTokens < 1000) {
+    return false;
+  }
+  _milliTokens -= 1000;
+  return true;
+}
+
+unsigned long TokenBucket::getRetryAfter() {
+  _refill();
+  if(_milliTokens >= 1000) {
+    return 0;
+  }
+  return (1000 - _milliTokens + _rate - 1) / _rate;
+}
+
+void TokenBucket::_refill() {
+  unsigned long now = millis();
+  uint32_t max = (uint32_t)_burst * 1000;
+  // rate tokens per s is rate thousandths of token per ms
+  unsigned long elapsed = now - _lastRefill;
+  _lastRefill = now;
+  if(elapsed >= max / _rate) {
+    _milliTokens = max;
+    return;
+  }
+  _milliTokens += elapsed * _rate;
+  if(_milliTokens > max) {
+    _milliTokens = max;
+  }
+}
+
+AdmissionControl::AdmissionControl(XIOTModule* module) {
+  _module = module;
+  for(int i = 0; i < ADMISSION_MAX_CLIENTS; i++) {
+    _clients[i].ip = 0;
+  }
+}
+
+/**
+ * Check the request being served can be processed: enough heap is free, and neither the client
+ * nor the route exceeded its rate. Otherwise the request is answered here, and false is returned.
+ * routeBucket is NULL for routes that have no rate of their own.
+ */
+bool AdmissionControl::admit(TokenBucket* routeBucket) {
+  if(ESP.getFreeHeap() < ADMISSION_MIN_FREE_HEAP) {
+    _heapRejectedCount ++;
+    _reject(503, ADMISSION_HEAP_RETRY_AFTER * 1000);
+    return false;
+  }
+  TokenBucket* clientBucket = _getClientBucket(_module->getServer()->client().remoteIP());
+  if(!clientBucket->take()) {
+    _clientRejectedCount ++;
+    _reject(429, clientBucket->getRetryAfter());
+    return false;
+  }
+  if(routeBucket != NULL && !routeBucket->take()) {
+    _routeRejectedCount ++;
+    _reject(503, routeBucket->getRetryAfter());
+    return false;
+  }
+  return true;
+}
+
+// Bucket of the client, the least recently seen client is replaced if it's a new one
+TokenBucket* AdmissionControl::_getClientBucket(uint32_t ip) {
+  admissionClientType* client = &_clients[0];
+  for(int i = 0; i < ADMISSION_MAX_CLIENTS; i++) {
+    if(_clients[i].ip == ip) {
+      client = &_clients[i];
+      client->lastSeen = millis();
+      return &client->bucket;
+    }
+    if(_clients[i].ip == 0 || (client->ip != 0 && _clients[i].lastSeen < client->lastSeen)) {
+      client = &_clients[i];
+    }
+  }
+  client->ip = ip;
+  client->bucket = TokenBucket();
+  client->lastSeen = millis();
+  return &client->bucket;
+}
+
+void AdmissionControl::_reject(int httpCode, unsigned long retryAfter) {
+  char retryAfterStr[10];
+  // Retry-After is in seconds
+  unsigned long seconds = (retryAfter + 999) / 1000;
+  sprintf(retryAfterStr, "%lu", seconds > 0 ? seconds : 1);
+  _module->getServer()->sendHeader("Retry-After", retryAfterStr);
+  _module->sendJson("{}", httpCode);
+}
+
+unsigned long AdmissionControl::getHeapRejectedCount() {
+  return _heapRejectedCount;
+}
+
+unsigned long AdmissionControl::getClientRejectedCount() {
+  return _clientRejectedCount;
+}
+
+unsigned long AdmissionControl::getRouteRejectedCount() {
+  return _routeRejectedCount;
+}
@@ -0,0 +1,62 @@
+/**
+ *  Admission control of the requests served by the iotinator master: rate limits and heap gate
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <XIOTModule.h>
+
+// Below this free heap, requests are answered 503 before their handler allocates anything
+#define ADMISSION_MIN_FREE_HEAP 6000
+#define ADMISSION_HEAP_RETRY_AFTER 2  // s
+// Each client (ip) can do that many requests per second, with bursts up to ADMISSION_CLIENT_BURST
+#define ADMISSION_CLIENT_RATE 10
+#define ADMISSION_CLIENT_BURST 20
+// Number of clients tracked, the least recently seen one is forgotten
+#define ADMISSION_MAX_CLIENTS 8
+// Each route, whatever the client
+#define ADMISSION_ROUTE_RATE 20
+#define ADMISSION_ROUTE_BURST 30
+
+/**
+ * Token bucket: each request takes a token, tokens come back at rate per second,
+ * up to burst tokens.
+ */
+class TokenBucket {
+public:
+  TokenBucket(uint16_t rate = ADMISSION_CLIENT_RATE, uint16_t burst = ADMISSION_CLIENT_BURST);
+  bool take();
+  unsigned long getRetryAfter();  // ms until a token is available
+  
+protected:
+  uint16_t _rate;
+  uint16_t _burst;
+  uint32_t _milliTokens;  // thousandths of token
+  unsigned long _lastRefill;
+  void _refill();
+};
+
+typedef struct {
+  uint32_t ip;  // 0 when slot is free
+  TokenBucket bucket;
+  unsigned long lastSeen;
+} admissionClientType;
+
+class AdmissionControl {
+public:
+  AdmissionControl(XIOTModule* module);
+  bool admit(TokenBucket* routeBucket);
+  unsigned long getHeapRejectedCount();
+  unsigned long getClientRejectedCount();
+  unsigned long getRouteRejectedCount();
+  
+protected:
+  XIOTModule* _module;
+  admissionClientType _clients[ADMISSION_MAX_CLIENTS];
+  unsigned long _heapRejectedCount = 0;
+  unsigned long _clientRejectedCount = 0;
+  unsigned long _routeRejectedCount = 0;
+  TokenBucket* _getClientBucket(uint32_t ip);
+  void _reject(int httpCode, unsigned long retryAfter);
+};
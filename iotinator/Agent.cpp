@@ -5,19 +5,29 @@
  */
 
 #include "Agent.h"
+#include "PingResponseScanner.h"
+
+char Agent::_pingCustom[MAX_CUSTOM_DATA_SIZE + 1];
 
 /*********************************************************************
  * Class to handle one agent module in master
  *
  *********************************************************************/
-Agent::Agent(const char* name, const char* mac, XIOTModule* module) {
+Agent::Agent(const char* name, const char* mac, XIOTModule* module, AgentHttpPool* httpPool) {
   XUtils::safeStringCopy(_name, name, NAME_MAX_LENGTH);
   XUtils::safeStringCopy(_mac, mac, NAME_MAX_LENGTH);
   _module = module;
+  _httpPool = httpPool;
+  _ip[0] = 0;
+  _uiClassName[0] = 0;
+  _updateListSize();
 }
 
 Agent::~Agent() {
   free(_custom);
+  if(_listSizeTotal != NULL) {
+    *_listSizeTotal -= _listSize;
+  }
 }
 
 const char* Agent::getName() {
@@ -25,7 +35,9 @@ const char* Agent::getName() {
   return _name;
 }
 void Agent::setName(const char* name) {
+  _registrationHash = 0;
   XUtils::safeStringCopy(_name, name, NAME_MAX_LENGTH);
+  _updateListSize();
 }
 
 const char* Agent::getIP() {
@@ -39,11 +51,15 @@ const char* Agent::getMAC() {
 }
 
 void Agent::setIP(const char* ip) {
+  _registrationHash = 0;
   XUtils::safeStringCopy(_ip, ip, DOUBLE_IP_MAX_LENGTH);
+  _updateListSize();
 }
 
 void Agent::setUiClassName(const char* uiClassName) {
+  _registrationHash = 0;
   XUtils::safeStringCopy(_uiClassName, uiClassName, UI_CLASS_NAME_MAX_LENGTH);
+  _updateListSize();
 }
 const char* Agent::getUiClassName() {
   return _uiClassName;
@@ -53,6 +69,19 @@ int8_t Agent::getConnected() {
   return _connected;
 }
 
+void Agent::setConnected(int8_t connected) {
+  _connected = connected;
+  _updateListSize();
+}
+
+bool Agent::getStationConnected() {
+  return _stationConnected;
+}
+
+void Agent::setStationConnected(bool flag) {
+  _stationConnected = flag;
+}
+
 void Agent::setToRename(bool flag) {
   _toRename = flag;
 }
@@ -63,6 +92,7 @@ bool Agent::getToRename() {
 
 void Agent::setHeap(uint32_t heap) {
   _heap = heap;
+  _updateListSize();
 }
 
 uint32_t Agent::getHeap() {
@@ -74,7 +104,9 @@ bool Agent::getCanSleep() {
 }
 
 void Agent::setCanSleep(bool canSleep) {
+  _registrationHash = 0;
   _canSleep = canSleep;
+  _updateListSize();
 }
 
 int Agent::getPingPeriod() {
@@ -82,12 +114,14 @@ int Agent::getPingPeriod() {
 }
 
 void Agent::setPingPeriod(int pingPeriod) {
+  _registrationHash = 0;
   // If value too small, keep default (legacy: when absent, value is 0)
   if(pingPeriod >= MIN_PING_PERIOD ) {
     _pingPeriod = pingPeriod;
   } else {
     _pingPeriod = 0;
   }
+  _updateListSize();
 }
 time_t Agent::getLastPing() {
   return _lastPing;
@@ -97,35 +131,67 @@ void Agent::setLastPing(time_t timestamp) {
   _lastPing = timestamp;
 }
 
+time_t Agent::getLastHeartbeat() {
+  return _lastHeartbeat;
+}
+
+void Agent::setLastHeartbeat(time_t timestamp) {
+  _lastHeartbeat = timestamp;
+}
+
 void Agent::setCustom(const char *custom) {
-  Debug("Agent::setCustom\n");
-  free(_custom); // This field is manually allocated, so it must be freed.
-  _custom = NULL;
+  setCustom(custom, custom == NULL ? 0 : strlen(custom));
+}
 
-  if(custom == NULL) {
-    _custom = NULL;
-    return;
-  }
-  int size = strlen(custom);
-  if(size > MAX_CUSTOM_DATA_SIZE) {
+// custom does not need to be null terminated, only size bytes are copied
+void Agent::setCustom(const char *custom, int size) {
+  Debug("Agent::setCustom\n");
+  _registrationHash = 0;
+  if(custom != NULL && size > MAX_CUSTOM_DATA_SIZE) {
     Serial.println(CUSTOM_DATA_TOO_BIG_VALUE);
-    size = strlen(CUSTOM_DATA_TOO_BIG_VALUE) ;
-    _custom = (char *)malloc(size + 1);   // Will need to be freed, when we unregister agent, or overwrite one...
-    XUtils::safeStringCopy(_custom, CUSTOM_DATA_TOO_BIG_VALUE, size);
+    custom = CUSTOM_DATA_TOO_BIG_VALUE;
+    size = strlen(custom);
+  }
+  if(custom == NULL || size == 0) {
+    free(_custom);
+    _custom = NULL;
+    _customCapacity = 0;
   } else {
-    _custom = (char *)malloc(size + 1);   // Will need to be freed, when we unregister agent, or overwrite one...
-    XUtils::safeStringCopy(_custom, custom, size);
+    // Most modules send custom data of about the same size each time: the buffer only grows
+    if(size > _customCapacity) {
+      free(_custom);
+      _custom = (char *)malloc(size + 1);
+      _customCapacity = _custom == NULL ? 0 : size;
+    }
+    if(_custom == NULL) {
+      Serial.printf("Not enough heap for custom data of %s\n", getName());
+    } else {
+      memcpy(_custom, custom, size);
+      _custom[size] = 0;
+    }
   }
+  _updateListSize();
 }
 
+// Compare custom data with a buffer which does not need to be null terminated
+bool Agent::isCustomEqual(const char *custom, int size) {
+  const char* current = _custom == NULL ? "" : _custom;
+  if(custom == NULL) {
+    return current[0] == 0;
+  }
+  return ((int)strlen(current) == size) && (strncmp(current, custom, size) == 0);
+}
+
+// Returns NULL if no custom data
 const char* Agent::getCustom() {
   Debug("Agent::getCustom\n");
-  if(_custom != NULL) {
-    if(strcmp(_custom, CUSTOM_DATA_TOO_BIG_VALUE) == 0) {
-      Serial.println(CUSTOM_DATA_TOO_BIG_VALUE);
-      _module->getDisplay()->setLine(1, "Custom Data too big", TRANSIENT, NOT_BLINKING);
-      _module->getDisplay()->setLine(2, getName(), TRANSIENT, NOT_BLINKING);
-    }
+  if(_custom == NULL) {
+    return NULL;
+  }
+  if(strcmp(_custom, CUSTOM_DATA_TOO_BIG_VALUE) == 0) {
+    Serial.println(CUSTOM_DATA_TOO_BIG_VALUE);
+    _module->getDisplay()->setLine(1, "Custom Data too big", TRANSIENT, NOT_BLINKING);
+    _module->getDisplay()->setLine(2, getName(), TRANSIENT, NOT_BLINKING);
   }
   return _custom;
 }
@@ -140,7 +206,7 @@ void Agent::renameTo(const char* newName) {
   root[XIOTModuleJsonTag::name] = newName ;
   root.printTo(renameMsg, 100);
   Serial.printf("Renaming payload: %s\n", renameMsg);   
-  _module->APIPost(getIP(), "/api/rename", renameMsg, &httpCode);
+  _httpPool->APIPost(getIP(), "/api/rename", renameMsg, &httpCode);
   if(httpCode != 200) {
     _module->getDisplay()->setLine(1, "Renaming failed", TRANSIENT, NOT_BLINKING);
   } else {
@@ -153,21 +219,33 @@ void Agent::renameTo(const char* newName) {
 
 // Returns 0 if module was not pinged due to ping period or canSleep flag
 // Returns 1 if ping was successfull
-// Returns -1 if ping failed
-int8_t Agent::ping() {
+// Returns -1 if ping failed, or if the module is known to be off the Access Point
+// When force is true, ping period and canSleep flag are ignored (used to verify a reconnection)
+int8_t Agent::ping(bool force) {
   Debug("Agent::ping\n");
   int httpCode;
 
   time_t now = millis();
-  bool elapsed = false;
+  // Module left the Access Point: no need to wait for a ping time out to know it's down
+  if(!_stationConnected) {
+    setConnected(-1);
+    Serial.printf("Not pinging module '%s': off the Access Point\n", _name);
+    return _connected;
+  }
+  // Module recently sent a UDP heartbeat: it's alive, HTTP ping is only a fallback
+  if(!force && _lastHeartbeat != 0 && (now - _lastHeartbeat < HEARTBEAT_FRESHNESS)) {
+    setConnected(1);
+    return _connected;
+  }
+  bool elapsed = force;
   if(_pingPeriod > 0) {
-    elapsed = (now >= (_lastPing + (_pingPeriod*1000)));
-  } else {
-    _connected = 0;  // do not ping : can't tell if connected or not.
+    elapsed = elapsed || (now >= (_lastPing + (_pingPeriod*1000)));
+  } else if(!force) {
+    setConnected(0);  // do not ping : can't tell if connected or not.
   }
-  if(_canSleep || !elapsed) {
+  if(!force && (_canSleep || !elapsed)) {
     if(_canSleep) {
-      _connected = 0;
+      setConnected(0);
     }
     Serial.printf("Not pinging module '%s' on ip '%s': canSleep: %d, pingPeriod: %d\n", _name, _ip, _canSleep, _pingPeriod);
     return 0;    
@@ -176,22 +254,36 @@ int8_t Agent::ping() {
   
   Serial.printf("Ping module '%s' on ip '%s' pingPeriod %d\n", _name, _ip, _pingPeriod);
   
-  int resultSize = 100 + MAX_CUSTOM_DATA_SIZE; 
-  char resultPayload[resultSize];
-  _module->APIGet(_ip, "/api/ping", &httpCode, resultPayload, resultSize);
+  // The response is scanned while it's read from the connection: custom data is unescaped in a
+  // buffer shared by all agents (pings are sequential), and only copied to this agent if it changed.
+  PingResponseScanner scanner(_pingCustom, MAX_CUSTOM_DATA_SIZE + 1);
+  unsigned long pingStart = millis();
+  _httpPool->APIGet(_ip, "/api/ping", &httpCode, &scanner);
 
   if(httpCode == 200) {
-    _connected = 1;
-    const int bufferSize = JSON_OBJECT_SIZE(2);  // At most 2 fields in one object
-    StaticJsonBuffer<bufferSize> jsonBuffer;
-    JsonObject& root = jsonBuffer.parseObject(resultPayload);
-    int heap = root[XIOTModuleJsonTag::heap];
-    Serial.printf("Heap module %s: %d\n", getName(), heap);
-    setHeap(heap);
-    Debug("Custom: %s\n", (const char *)root[XIOTModuleJsonTag::custom]);
-    setCustom(root[XIOTModuleJsonTag::custom]);  
+    setConnected(1);
+    _stats.success(millis() - pingStart);
+    const char* custom = NULL;
+    int customSize = 0;
+    if(!scanner.isComplete()) {
+      Serial.printf("Ping response parse failure for %s\n", getName());
+    } else if(scanner.isCustomTooBig()) {
+      Serial.println(CUSTOM_DATA_TOO_BIG_VALUE);
+      custom = CUSTOM_DATA_TOO_BIG_VALUE;
+      customSize = strlen(custom);
+    } else if(scanner.isCustomFound()) {
+      custom = _pingCustom;
+      customSize = scanner.getCustomSize();
+    }
+    if(!isCustomEqual(custom, customSize)) {
+      setCustom(custom, customSize);
+    }
+    Serial.printf("Heap module %s: %d\n", getName(), scanner.getHeap());
+    setHeap(scanner.getHeap());
+    Debug("Custom: %s\n", _custom == NULL ? "" : _custom);
   } else {
-    _connected = -1;
+    setConnected(-1);
+    _stats.failure();
     char message[100];
     sprintf(message, "Ping failed: %s", _name);
     _module->getDisplay()->setLine(1, message, TRANSIENT, NOT_BLINKING); 
@@ -201,9 +293,68 @@ int8_t Agent::ping() {
   return _connected;
 }
 
-bool Agent::reset() {
-  Debug("Agent::reset\n");
-  int httpCode;
-  _module->APIGet(getIP(), "/api/moduleReset", &httpCode);  
-  return (httpCode == 200);
+AgentStats* Agent::getStats() {
+  return &_stats;
+}
+
+uint32_t Agent::getRegistrationHash() {
+  return _registrationHash;
+}
+
+void Agent::setRegistrationHash(uint32_t hash) {
+  _registrationHash = hash;
+}
+
+int Agent::getListSize() {
+  return _listSize;
+}
+
+void Agent::setListSizeTotal(int* total) {
+  _listSizeTotal = total;
+  if(_listSizeTotal != NULL) {
+    *_listSizeTotal += _listSize;
+  }
+}
+
+/**
+ * Compute the length of "mac":{"name":"...",...} as printed by AgentCollection::list
+ */
+void Agent::_updateListSize() {
+  int fieldCount = 7;
+  int size = _jsonFieldSize(_mac, 2);  // braces
+  size += _jsonFieldSize(XIOTModuleJsonTag::name, _jsonStringSize(_name));
+  size += _jsonFieldSize(XIOTModuleJsonTag::ip, _jsonStringSize(_ip));
+  size += _jsonFieldSize(XIOTModuleJsonTag::canSleep, _canSleep ? 4 : 5);  // true or false
+  size += _jsonFieldSize(XIOTModuleJsonTag::connected, _jsonNumberSize(_connected));
+  size += _jsonFieldSize(XIOTModuleJsonTag::uiClassName, _jsonStringSize(_uiClassName));
+  size += _jsonFieldSize(XIOTModuleJsonTag::heap, _jsonNumberSize(_heap));
+  size += _jsonFieldSize(XIOTModuleJsonTag::pingPeriod, _jsonNumberSize(_pingPeriod));
+  if(_custom != NULL) {
+    size += _jsonFieldSize(XIOTModuleJsonTag::custom, _jsonStringSize(_custom));
+    fieldCount ++;
+  }
+  size += fieldCount - 1;  // commas
+  if(_listSizeTotal != NULL) {
+    *_listSizeTotal += size - _listSize;
+  }
+  _listSize = size;
+}
+
+// Length of the string once quoted and escaped the way ArduinoJson does
+int Agent::_jsonStringSize(const char* str) {
+  int size = 2;
+  for(const char* c = str; *c != 0; c++) {
+    size += (strchr("\"\\\b\f\n\r\t", *c) != NULL) ? 2 : 1;
+  }
+  return size;
+}
+
+int Agent::_jsonNumberSize(long number) {
+  char buffer[12];
+  return sprintf(buffer, "%ld", number);
+}
+
+// "name":value
+int Agent::_jsonFieldSize(const char* name, int valueSize) {
+  return _jsonStringSize(name) + 1 + valueSize;
 }
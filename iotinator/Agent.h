@@ -9,11 +9,16 @@
 #include <XIOTDisplay.h>
 #include <XIOTModule.h>
 #include <XUtils.h>
+#include "AgentHttpPool.h"
+#include "AgentStats.h"
 
 //#define DEBUG_AGENT // Uncomment this to enable debug messages over serial port
 
 #define MIN_PING_PERIOD 30
 
+// A module which sent a UDP heartbeat more recently than this (ms) is not pinged over HTTP
+#define HEARTBEAT_FRESHNESS (2 * MIN_PING_PERIOD * 1000)
+
 #ifdef DEBUG_AGENT
 #define Debug(...) Serial.printf(__VA_ARGS__)
 #else
@@ -22,10 +27,9 @@
 
 class Agent {
 public:
-  Agent(const char *name, const char* mac, XIOTModule* module);
+  Agent(const char *name, const char* mac, XIOTModule* module, AgentHttpPool* httpPool);
   ~Agent();
-  int8_t ping(); // ping this agent
-  bool reset(); // reset this agent
+  int8_t ping(bool force = false); // ping this agent. force: ignore ping period and canSleep
   void setName(const char*);
   const char* getName();
   void setIP(const char*);
@@ -34,6 +38,13 @@ public:
   const char* getUiClassName();
   const char* getMAC();
   int8_t getConnected();
+  void setConnected(int8_t connected);
+  /**
+   * Station events on the master's Access Point tell immediately when an agent drops
+   * off the wifi, or comes back, without waiting for the next ping.
+   */
+  bool getStationConnected();
+  void setStationConnected(bool flag);
   void setToRename(bool flag);
   bool getToRename();
   void setHeap(uint32_t heap);
@@ -48,13 +59,31 @@ public:
   void setPingPeriod(int);
   time_t getLastPing();
   void setLastPing(time_t);
+  time_t getLastHeartbeat();
+  void setLastHeartbeat(time_t);
   void setCustom(const char*);
+  void setCustom(const char*, int size);
+  bool isCustomEqual(const char*, int size);
   const char* getCustom();
   void renameTo(const char* newName);
+  AgentStats* getStats();
+  /**
+   * Hash of the fields received at registration, to tell if a module registering again sent
+   * the same data. Any change to these fields resets it to 0.
+   */
+  uint32_t getRegistrationHash();
+  void setRegistrationHash(uint32_t hash);
+  /**
+   * Length of this agent's json in the agent list, kept up to date by the setters.
+   * Changes are also applied to the total, if given (the collection's list length).
+   */
+  int getListSize();
+  void setListSizeTotal(int* total);
   
 protected:   
 
   XIOTModule* _module;
+  AgentHttpPool* _httpPool;
   char _mac[MAC_ADDR_MAX_LENGTH + 1]; // for modules connected to a agent's AP, store 2 ips
   char _ip[DOUBLE_IP_MAX_LENGTH + 1]; // for modules connected to a agent's AP, store 2 ips and separator
   char _name[NAME_MAX_LENGTH + 1];
@@ -64,7 +93,19 @@ protected:
   bool _canSleep = false; // if true, module must not be pinged 
   int _pingPeriod = 0; // default ping period is "do not ping"
   time_t _lastPing = 0;
+  time_t _lastHeartbeat = 0;  // 0 if no heartbeat received (module only supports HTTP ping)
+  bool _stationConnected = true; // New agent is created upon registration, so it's on the AP
   uint32_t _heap = 0;
-  char * _custom = NULL; // custom data sent by module at registration, dynamicall allocated
+  uint32_t _registrationHash = 0;
+  int _listSize = 0;
+  int* _listSizeTotal = NULL;
+  void _updateListSize();
+  int _jsonStringSize(const char* str);
+  int _jsonNumberSize(long number);
+  int _jsonFieldSize(const char* name, int valueSize);
+  AgentStats _stats;
+  char* _custom = NULL; // custom data sent by module at registration or ping, on the heap, NULL if none
+  int _customCapacity = 0; // size of the _custom buffer, terminating 0 excluded
+  static char _pingCustom[MAX_CUSTOM_DATA_SIZE + 1]; // where ping responses are scanned, for all agents
 
 }; 
\ No newline at end of file
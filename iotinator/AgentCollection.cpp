@@ -5,9 +5,13 @@
  */
 
 #include "AgentCollection.h"
+#include "Fnv1a.h"
 
 AgentCollection::AgentCollection(XIOTModule* module) {
   _module = module;
+  _httpPool = new AgentHttpPool(module);
+  _workQueue = new WorkQueue(this);
+  _parallelHttp = new ParallelHttp(_httpPool);
   Debug("Agent count: %d\n", getCount());
 }
 
@@ -40,13 +44,15 @@ Agent* AgentCollection::refresh(char* jsonStr) {
   }
   Agent *agent = it->second;
   _module->getDisplay()->setLine(2, agent->getName(), TRANSIENT, NOT_BLINKING);
-  agent->setCustom((const char*)root[XIOTModuleJsonTag::custom]);
+  agent->setCustom(custom);
+  _changed();
   return agent; // ptr to agent in collection, safe to return.
 }
 
 /**
  * Register a new agent
- * data from jsonStr needs to be copied, since it will be freed
+ * jsonStr is parsed in place: it's modified, and data from it needs to be copied since it
+ * belongs to the request
  */ 
 Agent* AgentCollection::add(char* jsonStr) {
   StaticJsonBuffer<JSON_BUFFER_REGISTER_SIZE> jsonBuffer; 
@@ -64,23 +70,45 @@ Agent* AgentCollection::add(char* jsonStr) {
     return NULL;
   }
   Debug("AgentCollection::add name '%s', mac '%s', ip '%s'\n", name, mac, ip);
+  // Same data as last registration (module reconnecting after a wifi glitch): only liveness is updated.
+  // Custom data is also updated by pings, without going through the registration hash: it's compared.
+  uint32_t hash = _registrationHash(root);
+  const char *custom = (const char*)root[XIOTModuleJsonTag::custom];
+  agentMap::iterator it = _agents.find(mac);
+  if(it != _agents.end() && it->second->getRegistrationHash() == hash
+     && it->second->isCustomEqual(custom, custom == NULL ? 0 : strlen(custom))) {
+    Agent* agent = it->second;
+    agent->setHeap((int32_t)root[XIOTModuleJsonTag::heap]);
+    agent->setLastPing(millis());
+    agent->setStationConnected(true);
+    if(agent->getConnected() != 1) {
+      agent->setConnected(1);
+      _changed();
+    }
+    return agent;
+  }
   _module->getDisplay()->setLine(1, "Registering", TRANSIENT, NOT_BLINKING);
   _module->getDisplay()->setLine(2, name, TRANSIENT, NOT_BLINKING);
-  Agent* agent = new Agent(name, mac, _module);
+  Agent* agent = new Agent(name, mac, _module, _httpPool);
   // Insert it.
   std::pair <agentMap::iterator, bool> agentIt = _agents.insert(agentPair(mac, agent));
   // If not inserted because exists, point to the one already registered so that we can update it
   if(!agentIt.second) {
     delete agent;
     agent = agentIt.first->second;
+  } else {
+    agent->setListSizeTotal(&_listSize);
   }
   // We need to update some fields...  
   agent->setCanSleep((bool)root[XIOTModuleJsonTag::canSleep]);
-  agent->setCustom((const char*)root[XIOTModuleJsonTag::custom]);
+  agent->setCustom(custom);
   agent->setUiClassName((const char*)root[XIOTModuleJsonTag::uiClassName]);
   agent->setHeap((int32_t)root[XIOTModuleJsonTag::heap]);
   agent->setPingPeriod((int)root[XIOTModuleJsonTag::pingPeriod]);  // Will set it to 0 if absent
   agent->setLastPing(millis());
+  // A module registering is obviously connected to the Access Point
+  agent->setStationConnected(true);
+  agent->setConnected(1);
 
   agent->setIP(ip);
   
@@ -89,46 +117,48 @@ Agent* AgentCollection::add(char* jsonStr) {
   if(nameAlreadyExists(name, mac)) {
     // Renaming will occur later, not within this request processing
     agent->setToRename(true);
-  }  
-  _refreshListBufferSize();
+    _workQueue->push(WORK_RENAME, agent->getMAC());
+  } else {
+    // Not set when renaming is needed: next registration needs to go through the checks again
+    agent->setRegistrationHash(hash);
+  }
+  _changed();
   return agent;
 }
 
 /**
- * Compute the buffer size to hold one attribute, its value and json syntax elements, for all registered modules
- **/
-int AgentCollection::_jsonAttributeSize(int moduleCount, const char *attrName, int valueSize) {
-  // size of the value of the attribute + size of its name + 2 double quotes + semi colon + coma 
-  return moduleCount * (valueSize + strlen(attrName) + 2 + 1 + 1);
+ * FNV-1a hash of the registration fields, except the heap which changes all the time.
+ * Never 0, which means no hash.
+ */
+uint32_t AgentCollection::_registrationHash(JsonObject& root) {
+  const char* tags[] = {XIOTModuleJsonTag::name, XIOTModuleJsonTag::MAC, XIOTModuleJsonTag::ip,
+                        XIOTModuleJsonTag::custom, XIOTModuleJsonTag::uiClassName};
+  uint32_t hash = FNV1A_BASIS;
+  for(unsigned int i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+    const char* value = root[tags[i]];
+    // The terminating 0 separates the values, absent ones are hashed as 0xFF
+    if(value == NULL) {
+      uint8_t absent = 0xFF;
+      hash = fnv1a(hash, &absent, 1);
+    } else {
+      hash = fnv1a(hash, value, strlen(value) + 1);
+    }
+  }
+  int32_t numbers[] = {(bool)root[XIOTModuleJsonTag::canSleep], (int)root[XIOTModuleJsonTag::pingPeriod]};
+  hash = fnv1a(hash, numbers, sizeof(numbers));
+  return hash == 0 ? 1 : hash;
 }
 
 /**
- * Compute the buffer size to hold the json string listing all registered agent modules
- **/
-void AgentCollection::_refreshListBufferSize() {
-  int moduleCount = getCount();
-  _listBufferSize = LIST_BUFFER_SIZE;
-  // Adding 2 for surrounding double quotes, and one for the comma.
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::MAC, MAC_ADDR_MAX_LENGTH + 3);
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::name, NAME_MAX_LENGTH + 3);
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::ip, DOUBLE_IP_MAX_LENGTH + 3);
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::canSleep, 5 + 3);  // "true" or "false"
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::connected, 3 + 1); // 1, 0 or -1
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::pingPeriod, 6 + 1);
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::uiClassName, UI_CLASS_NAME_MAX_LENGTH + 3);
-  _listBufferSize += _jsonAttributeSize(moduleCount, XIOTModuleJsonTag::heap, 6 + 1);
-}
-
-void AgentCollection::list(JsonObject& root, int* customSize) {
-  int size = getCount();
-  Debug("AgentCollection::list %d agents\n", size);
-  *customSize = _listBufferSize;
-  if(size == 0) {
-    return ;  
-  }
-  
+ * Fill root with the list version and the list of agents: getListSize() is the length of its json.
+ */
+void AgentCollection::list(JsonObject& root) {
+  Debug("AgentCollection::list %d agents\n", getCount());
+  // Clients can compare the version with the previous one to know if anything changed
+  root[JSON_TAG_LIST_VERSION] = _version;
+  JsonObject& agentList = root.createNestedObject(JSON_TAG_AGENT_LIST);
   for (agentMap::iterator it=_agents.begin(); it!=_agents.end(); ++it) {
-    JsonObject& agent = root.createNestedObject(it->second->getMAC());
+    JsonObject& agent = agentList.createNestedObject(it->second->getMAC());
     agent[XIOTModuleJsonTag::name] = it->second->getName();
     agent[XIOTModuleJsonTag::ip] = it->second->getIP();
     agent[XIOTModuleJsonTag::canSleep] = (bool)it->second->getCanSleep();
@@ -139,27 +169,78 @@ void AgentCollection::list(JsonObject& root, int* customSize) {
     char *custom = (char *)it->second->getCustom();
     if(custom != NULL) {
       agent[XIOTModuleJsonTag::custom] = custom;
-      *customSize += strlen(custom);    
     }
     Debug("Name '%s' on mac '%s'\n", it->second->getName(), it->second->getMAC());
   }
 }
 
-void AgentCollection::reset() {
-  int size = getCount();
-  const char *ip, *name; 
-  Serial.printf("AgentCollection::reset %d agents\n", size);
+/**
+ * Add the liveness statistics of the agent with the given MAC address, or of every agent if mac
+ * is NULL, to the root object. Returns false if the agent was not found.
+ */
+bool AgentCollection::stats(JsonObject& root, const char* mac) {
+  if(mac != NULL) {
+    Agent *agent = getByMac(mac);
+    if(agent == NULL) {
+      return false;
+    }
+    JsonObject& agentStats = root.createNestedObject(agent->getMAC());
+    agent->getStats()->toJson(agentStats);
+    return true;
+  }
   for (agentMap::iterator it=_agents.begin(); it!=_agents.end(); ++it) {
-    ip = it->second->getIP();
-    name = it->second->getName();
-    Serial.printf("Reset module '%s' on ip '%s'\n", name, ip);
-    bool result = it->second->reset();
-    if(result) {
-      
+    JsonObject& agentStats = root.createNestedObject(it->second->getMAC());
+    it->second->getStats()->toJson(agentStats);
+  }
+  return true;
+}
+
+void AgentCollection::reset() {
+  Serial.printf("AgentCollection::reset %d agents\n", getCount());
+  fanOutResultType result = fanOut([](Agent* agent) { return true; }, "GET", "/api/moduleReset", NULL,
+    [](Agent* agent, int httpCode) {
+      Serial.printf("Reset module '%s' on ip '%s': %s\n", agent->getName(), agent->getIP(), httpCode == 200 ? "ok" : "nok");
+    });
+  Serial.printf("Reset %d/%d modules\n", result.succeeded, result.count);
+}
+
+/**
+ * Send the same request to every agent selected by the filter, through the parallel executor:
+ * agents are requested PARALLEL_HTTP_MAX at a time, each one being given timeout ms to answer.
+ * The handler, if any, is called with the result of each request.
+ */
+fanOutResultType AgentCollection::fanOut(agentFilter filter, const char* method, const char* path, const char* body,
+                                         fanOutHandler handler, unsigned long timeout) {
+  fanOutResultType result = {0, 0};
+  parallelRequestType requests[PARALLEL_HTTP_MAX];
+  Agent* agents[PARALLEL_HTTP_MAX];
+  int count = 0;
+  agentMap::iterator it = _agents.begin();
+  while(it != _agents.end() || count > 0) {
+    if(it != _agents.end()) {
+      Agent* agent = it->second;
+      ++it;
+      if(!filter(agent)) continue;
+      requests[count].ip = agent->getIP();
+      requests[count].method = method;
+      requests[count].path = path;
+      requests[count].body = body;
+      agents[count++] = agent;
+      if(count < PARALLEL_HTTP_MAX && it != _agents.end()) continue;
     }
-    
-    Serial.printf("Result: %s\n", result?"ok":"nok");
+    _parallelHttp->execute(requests, count, timeout);
+    for(int i = 0; i < count; i++) {
+      result.count ++;
+      if(requests[i].httpCode >= 200 && requests[i].httpCode < 300) {
+        result.succeeded ++;
+      }
+      if(handler != NULL) {
+        handler(agents[i], requests[i].httpCode);
+      }
+    }
+    count = 0;
   }
+  return result;
 }
 
 void AgentCollection::ping() {
@@ -167,10 +248,165 @@ void AgentCollection::ping() {
   Debug("AgentCollection::ping %d agents\n", size);
   
   for (agentMap::iterator it=_agents.begin(); it!=_agents.end(); ++it) {  
+    int8_t connected = it->second->getConnected();
     it->second->ping();
+    if(connected != it->second->getConnected()) {
+      _changed();
+    }
   }  
 }
 
+/**
+ * Called when the window to collect answers to a sweep probe is over: the agents which used to
+ * send heartbeats but did not answer need to be checked with an HTTP ping.
+ */
+void AgentCollection::sweepDone(time_t sweepStart) {
+  for (agentMap::iterator it=_agents.begin(); it!=_agents.end(); ++it) {  
+    Agent *agent = it->second;
+    time_t lastHeartbeat = agent->getLastHeartbeat();
+    if(lastHeartbeat != 0 && lastHeartbeat < sweepStart) {
+      Serial.printf("No answer to sweep from '%s'\n", agent->getName());
+      agent->setLastHeartbeat(0);
+    }
+  }
+}
+
+/**
+ * Ping an agent which needs an early check (reconnection to the Access Point)
+ */
+void AgentCollection::verify(Agent *agent) {
+  int8_t connected = agent->getConnected();
+  agent->ping(true);
+  if(connected != agent->getConnected()) {
+    _changed();
+  }
+}
+
+/**
+ * Update an agent from a UDP heartbeat. Custom data does not need to be null terminated.
+ * Returns NULL if the agent is not registered.
+ */
+Agent* AgentCollection::heartbeat(const uint8_t* mac, uint32_t heap, const char* custom, int customSize) {
+  Agent *agent = getByMac(mac);
+  if(agent == NULL) return NULL;
+  time_t now = millis();
+  agent->setLastHeartbeat(now);
+  agent->setLastPing(now);
+  agent->setStationConnected(true);
+  _workQueue->cancel(WORK_VERIFY, agent->getMAC());
+  agent->setHeap(heap);
+  agent->getStats()->heartbeat();
+  bool changed = (agent->getConnected() != 1);
+  agent->setConnected(1);
+  if(!agent->isCustomEqual(custom, customSize)) {
+    agent->setCustom(custom, customSize);
+    changed = true;
+  }
+  if(changed) {
+    _changed();
+  }
+  return agent;
+}
+
+/**
+ * A station connected to the Access Point: if it's a registered agent, schedule an early ping
+ * to check it's back, rather than waiting for the next ping period.
+ */
+void AgentCollection::stationConnected(const uint8_t* mac) {
+  Agent *agent = getByMac(mac);
+  if(agent == NULL) return;
+  Serial.printf("Agent '%s' back on Access Point\n", agent->getName());
+  agent->setStationConnected(true);
+  _workQueue->push(WORK_VERIFY, agent->getMAC(), STATION_VERIFY_DELAY);
+  // Can't tell yet if it's really up until it answers
+  if(agent->getConnected() != 0) {
+    agent->setConnected(0);
+    _changed();
+  }
+}
+
+/**
+ * A station left the Access Point: if it's a registered agent, mark it down right away.
+ */
+void AgentCollection::stationDisconnected(const uint8_t* mac) {
+  Agent *agent = getByMac(mac);
+  if(agent == NULL) return;
+  Serial.printf("Agent '%s' left Access Point\n", agent->getName());
+  agent->getStats()->failure();
+  agent->setStationConnected(false);
+  _workQueue->cancel(WORK_VERIFY, agent->getMAC());
+  agent->setLastHeartbeat(0);
+  if(agent->getConnected() != -1) {
+    agent->setConnected(-1);
+    _changed();
+  }
+  _module->getDisplay()->setLine(2, agent->getName(), TRANSIENT, NOT_BLINKING);
+}
+
+/**
+ * Find an agent from its MAC address, whatever the case of the hexadecimal digits
+ */
+Agent* AgentCollection::getByMac(const char* mac) {
+  for (agentMap::iterator it=_agents.begin(); it!=_agents.end(); ++it) {
+    if(strcasecmp(it->second->getMAC(), mac) == 0) {
+      return it->second;
+    }
+  }
+  return NULL;
+}
+
+Agent* AgentCollection::getByMac(const uint8_t* mac) {
+  char macStr[MAC_ADDR_MAX_LENGTH + 1];
+  sprintf(macStr, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  return getByMac(macStr);
+}
+
+Agent* AgentCollection::getByIp(const char* ip) {
+  for (agentMap::iterator it=_agents.begin(); it!=_agents.end(); ++it) {
+    if(strcmp(it->second->getIP(), ip) == 0) {
+      return it->second;
+    }
+  }
+  return NULL;
+}
+
+AgentHttpPool* AgentCollection::getHttpPool() {
+  return _httpPool;
+}
+
+WorkQueue* AgentCollection::getWorkQueue() {
+  return _workQueue;
+}
+
+ParallelHttp* AgentCollection::getParallelHttp() {
+  return _parallelHttp;
+}
+
+/**
+ * Exact length of the json of the object filled by list(). Agents keep their own length up to date
+ * whenever one of their fields changes, so it does not need to be computed, nor measured.
+ */
+int AgentCollection::getListSize() {
+  char version[11];
+  int count = getCount();
+  // Agents are separated by commas
+  return strlen("{\"" JSON_TAG_LIST_VERSION "\":,\"" JSON_TAG_AGENT_LIST "\":{}}") + sprintf(version, "%lu", _version)
+         + _listSize + (count > 0 ? count - 1 : 0);
+}
+
+unsigned long AgentCollection::getVersion() {
+  return _version;
+}
+
+/**
+ * Any change in the agent list (registration, connection status...) increments the version
+ * so that clients polling the list can tell when something changed.
+ */
+void AgentCollection::_changed() {
+  _version ++;
+  Debug("AgentCollection version %lu\n", _version);
+}
+
 void AgentCollection::renameAgent(const char* agentIP, const char* newName) {
   const char *ip, *name; 
   for (agentMap::iterator it=_agents.begin(); it!=_agents.end(); ++it) {
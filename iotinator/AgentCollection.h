@@ -9,7 +9,10 @@
 #include <XIOTModule.h>
 #include <XUtils.h>
 #include "Agent.h"
+#include "WorkQueue.h"
+#include "ParallelHttp.h"
 #include <map>
+#include <functional>
 
 //#define DEBUG_AGENT_COLLECTION // Uncomment this to enable debug messages over serial port
 
@@ -19,13 +22,27 @@
 #define Debug(...)
 #endif
 
-// Arbitrary "security" additional buffer size. 
-#define LIST_BUFFER_SIZE 100
+#define JSON_TAG_LIST_VERSION "listVersion"
+#define JSON_TAG_AGENT_LIST "agentList"
+
+// Delay after a module reconnects to the Access Point before checking it with a ping,
+// to give it time to get its IP and start its web server.
+#define STATION_VERIFY_DELAY 5000
 
 // must not use char* as key
 typedef std::map <std::string, Agent*>  agentMap;
 typedef std::pair <std::string, Agent*>  agentPair;
 
+// Selects the agents a request is sent to by fanOut
+typedef std::function<bool(Agent*)> agentFilter;
+// Called by fanOut with the result of the request sent to each agent
+typedef std::function<void(Agent*, int httpCode)> fanOutHandler;
+
+typedef struct {
+  int count;      // number of agents the request was sent to
+  int succeeded;  // 2xx responses
+} fanOutResultType;
+
 class AgentCollection {
 public:
   AgentCollection(XIOTModule* module);
@@ -33,17 +50,37 @@ public:
   Agent* refresh(char* jsonStr);
   void remove(const char* mac);
   void ping();  // ping every agent
+  void sweepDone(time_t sweepStart);
   void reset(); // reset every agent
-  void list(JsonObject& root, int* customSize);
+  fanOutResultType fanOut(agentFilter filter, const char* method, const char* path, const char* body = NULL,
+                          fanOutHandler handler = NULL, unsigned long timeout = PARALLEL_HTTP_TIMEOUT);
+  void list(JsonObject& root);
+  int getListSize();
+  bool stats(JsonObject& root, const char* mac);
   int getCount();
   void autoRename(Agent *agent);
   bool nameAlreadyExists(const char* name, const char* mac);
   void renameAgent(const char* agentIp, const char* newName);
+  Agent* getByMac(const char* mac);
+  Agent* getByMac(const uint8_t* mac);
+  Agent* getByIp(const char* ip);
+  void stationConnected(const uint8_t* mac);
+  void stationDisconnected(const uint8_t* mac);
+  void verify(Agent *agent); // ping an agent which needs an early check
+  Agent* heartbeat(const uint8_t* mac, uint32_t heap, const char* custom, int customSize);
+  unsigned long getVersion();
+  AgentHttpPool* getHttpPool();
+  WorkQueue* getWorkQueue();
+  ParallelHttp* getParallelHttp();
   
 protected:
   agentMap _agents;
   XIOTModule* _module;
-  int _listBufferSize = LIST_BUFFER_SIZE;
-  void _refreshListBufferSize();
-  int _jsonAttributeSize(int moduleCount, const char *attrName, int valueSize);  
+  AgentHttpPool* _httpPool;
+  WorkQueue* _workQueue;
+  ParallelHttp* _parallelHttp;
+  int _listSize = 0;  // sum of the json lengths of the agents in the list
+  unsigned long _version = 0;  // incremented each time the agent list changes
+  void _changed();
+  uint32_t _registrationHash(JsonObject& root);
 };
\ No newline at end of file
@@ -0,0 +1,316 @@
+/**
+ *  Pool of persistent HTTP connections from the iotinator master to its agents
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "AgentHttpPool.h"
+
+BufferStream::BufferStream(char* buffer, int maxSize) {
+  _buffer = buffer;
+  _maxSize = maxSize;
+  if(_buffer != NULL && _maxSize > 0) {
+    *_buffer = 0;
+  }
+}
+
+size_t BufferStream::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t BufferStream::write(const uint8_t *data, size_t size) {
+  if(_buffer != NULL) {
+    // Keep room for the terminating 0
+    int toCopy = _maxSize - 1 - _size;
+    if(toCopy > (int)size) {
+      toCopy = size;
+    }
+    if(toCopy > 0) {
+      memcpy(_buffer + _size, data, toCopy);
+      _size += toCopy;
+      _buffer[_size] = 0;
+    }
+    if(toCopy < (int)size) {
+      _truncated = true;
+    }
+  }
+  return size;
+}
+
+bool BufferStream::isTruncated() {
+  return _truncated;
+}
+
+ProxyStream::ProxyStream(ESP8266WebServer* server, Stream* copy) {
+  _server = server;
+  _copy = copy;
+}
+
+size_t ProxyStream::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t ProxyStream::write(const uint8_t *data, size_t size) {
+  if(_copy != NULL) {
+    _copy->write(data, size);
+  }
+  size_t written = 0;
+  while(written < size) {
+    int toCopy = HTTP_PROXY_CHUNK_SIZE - _size;
+    if(toCopy > (int)(size - written)) {
+      toCopy = size - written;
+    }
+    memcpy(_chunk + _size, data + written, toCopy);
+    _size += toCopy;
+    written += toCopy;
+    if(_size == HTTP_PROXY_CHUNK_SIZE) {
+      flush();
+    }
+  }
+  return size;
+}
+
+// The chunk is sent as is: no String copy of it is made
+void ProxyStream::flush() {
+  if(_size == 0) return;
+  _server->sendContent_P(_chunk, _size);
+  _size = 0;
+}
+
+AgentHttpPool::AgentHttpPool(XIOTModule* module) {
+  _module = module;
+#ifdef METRICS_ENABLED
+  _forwardMetricId = metrics.add("forward.agent");
+  _relayMetricId = metrics.add("forward.relay");
+#endif
+  for(int i = 0; i < HTTP_POOL_SIZE; i++) {
+    _connections[i].ip[0] = 0;
+    _connections[i].lastUsed = 0;
+    _connections[i].busy = false;
+    _connections[i].http.setReuse(true);
+    _connections[i].http.setTimeout(HTTP_POOL_TIMEOUT);
+  }
+}
+
+/**
+ * Same as XIOTModule::APIGet, but reusing an open connection to the agent when possible
+ */
+void AgentHttpPool::APIGet(const char* ip, const char* path, int* httpCode, char* response, int maxSize) {
+  pooledConnectionType* connection = _acquire(ip, path);
+  if(connection == NULL) {
+    _module->APIGet(ip, path, httpCode, response, maxSize);
+    return;
+  }
+  *httpCode = connection->http.GET();
+  BufferStream stream(response, maxSize);
+  _readResponse(connection, *httpCode, &stream);
+  _release(connection);
+}
+
+/**
+ * Same as APIGet, but the body of a 200 response is written to the response stream while it
+ * is received, instead of being stored in a buffer. Other responses are discarded.
+ */
+void AgentHttpPool::APIGet(const char* ip, const char* path, int* httpCode, Stream* response) {
+  pooledConnectionType* connection = _acquire(ip, path);
+  if(connection == NULL) {
+    char buffer[HTTP_POOL_FALLBACK_BUFFER_SIZE];
+    *buffer = 0;
+    _module->APIGet(ip, path, httpCode, buffer, HTTP_POOL_FALLBACK_BUFFER_SIZE);
+    if(*httpCode == 200) {
+      response->write((const uint8_t *)buffer, strlen(buffer));
+    }
+    return;
+  }
+  *httpCode = connection->http.GET();
+  BufferStream discard(NULL, 0);
+  _readResponse(connection, *httpCode, *httpCode == 200 ? response : &discard);
+  _release(connection);
+}
+
+/**
+ * Same as XIOTModule::APIPost, but reusing an open connection to the agent when possible
+ */
+void AgentHttpPool::APIPost(const char* ip, const char* path, const char* body, int* httpCode, char* response, int maxSize) {
+  pooledConnectionType* connection = _acquire(ip, path);
+  if(connection == NULL) {
+    _module->APIPost(ip, path, body, httpCode, response, maxSize);
+    return;
+  }
+  connection->http.addHeader("Content-Type", "application/json");
+  *httpCode = connection->http.POST((uint8_t *)body, strlen(body));
+  BufferStream stream(response, maxSize);
+  _readResponse(connection, *httpCode, &stream);
+  _release(connection);
+}
+
+/**
+ * Forward the request being served by the web server to an agent, with the same method, uri and body.
+ * The agent's response is relayed to the client while it is received, so the memory used does not
+ * depend on its size. The response body is also written to copy, if given.
+ * Returns the http code of the agent's response.
+ */
+int AgentHttpPool::forward(const char* ip, Stream* copy) {
+  ESP8266WebServer* server = _module->getServer();
+  HTTPMethod method = server->method();
+  const char* methodName = method == HTTP_GET ? "GET" : method == HTTP_PUT ? "PUT" : method == HTTP_DELETE ? "DELETE" : "POST";
+  const String& path = server->uri();
+  const String& body = server->arg("plain");
+  int httpCode;
+  pooledConnectionType* connection = _acquire(ip, path.c_str());
+  if(connection == NULL) {
+    // XIOTModule only knows about GET and POST, and buffers the response
+    char buffer[HTTP_POOL_FALLBACK_BUFFER_SIZE];
+    *buffer = 0;
+    if(method == HTTP_GET) {
+      _module->APIGet(ip, path.c_str(), &httpCode, buffer, HTTP_POOL_FALLBACK_BUFFER_SIZE);
+    } else if(method == HTTP_POST) {
+      _module->APIPost(ip, path.c_str(), body.c_str(), &httpCode, buffer, HTTP_POOL_FALLBACK_BUFFER_SIZE);
+    } else {
+      _module->sendJson("{}", 501);
+      return 501;
+    }
+    if(copy != NULL) {
+      copy->write((const uint8_t *)buffer, strlen(buffer));
+    }
+    _module->sendJson(*buffer != 0 ? buffer : "{}", httpCode > 0 ? httpCode : 502);
+    return httpCode;
+  }
+  {
+    METRIC_SCOPE(_forwardMetricId);
+    if(body.length() > 0) {
+      connection->http.addHeader("Content-Type", "application/json");
+    }
+    httpCode = connection->http.sendRequest(methodName, (uint8_t *)body.c_str(), body.length());
+  }
+  if(httpCode <= 0) {
+    _readResponse(connection, httpCode, NULL);
+    _release(connection);
+    _module->sendJson("{}", 502);
+    return httpCode;
+  }
+  {
+    METRIC_SCOPE(_relayMetricId);
+    server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+    server->send(httpCode, "application/json", "");
+    ProxyStream stream(server, copy);
+    _readResponse(connection, httpCode, &stream);
+    stream.flush();
+    // Empty chunk ends the response
+    server->sendContent("");
+  }
+  _release(connection);
+  return httpCode;
+}
+
+/**
+ * Read the whole response body, even what does not fit in the buffer, so that the connection
+ * can be used for the next request.
+ */
+void AgentHttpPool::_readResponse(pooledConnectionType* connection, int httpCode, Stream* response) {
+  if(httpCode <= 0) {
+    Serial.printf("HTTP request to %s failed, error: %s\n", connection->ip, connection->http.errorToString(httpCode).c_str());
+    _close(connection);
+    return;
+  }
+  if(connection->http.writeToStream(response) < 0) {
+    _close(connection);
+  }
+}
+
+/**
+ * Get a connection to the given ip: an open one if any, otherwise a free one, otherwise the
+ * least recently used one is closed and reused.
+ * Returns NULL if no connection is available, or if the agent can't be reached directly.
+ */
+pooledConnectionType* AgentHttpPool::_acquire(const char* ip, const char* path) {
+  if(!isPoolable(ip)) {
+    return NULL;
+  }
+  pooledConnectionType* found = NULL;
+  pooledConnectionType* lru = NULL;
+  for(int i = 0; i < HTTP_POOL_SIZE; i++) {
+    pooledConnectionType* connection = &_connections[i];
+    if(connection->busy) continue;
+    if(strcmp(connection->ip, ip) == 0) {
+      found = connection;
+      break;
+    }
+    if(lru == NULL || connection->ip[0] == 0 || (lru->ip[0] != 0 && connection->lastUsed < lru->lastUsed)) {
+      lru = connection;
+    }
+  }
+  if(found == NULL) {
+    if(lru == NULL) {
+      return NULL;
+    }
+    _close(lru);
+    found = lru;
+    strcpy(found->ip, ip);
+  } else if(found->http.connected()) {
+    _reuseCount ++;
+  }
+  _requestCount ++;
+  found->busy = true;
+  found->http.begin(ip, 80, path);
+  found->http.setReuse(true);
+  return found;
+}
+
+void AgentHttpPool::_release(pooledConnectionType* connection) {
+  // Keeps the connection open if the agent accepted keep-alive
+  connection->http.end();
+  connection->lastUsed = millis();
+  connection->busy = false;
+}
+
+void AgentHttpPool::_close(pooledConnectionType* connection) {
+  connection->http.setReuse(false);
+  connection->http.end();
+  connection->http.setReuse(true);
+  connection->ip[0] = 0;
+}
+
+/**
+ * Close the connections that were not used recently, to give their resources back to lwIP
+ */
+void AgentHttpPool::expire() {
+  time_t now = millis();
+  for(int i = 0; i < HTTP_POOL_SIZE; i++) {
+    pooledConnectionType* connection = &_connections[i];
+    if(!connection->busy && connection->ip[0] != 0 && (now - connection->lastUsed >= HTTP_POOL_IDLE_TIMEOUT)) {
+      _close(connection);
+    }
+  }
+}
+
+void AgentHttpPool::closeAll() {
+  for(int i = 0; i < HTTP_POOL_SIZE; i++) {
+    if(!_connections[i].busy) {
+      _close(&_connections[i]);
+    }
+  }
+}
+
+// Modules connected to an agent's Access Point have a double ip: they are reached through
+// their agent, so they are left to XIOTModule.
+bool AgentHttpPool::isPoolable(const char* ip) {
+  int length = strlen(ip);
+  if(length == 0 || length > HTTP_POOL_IP_MAX_LENGTH) {
+    return false;
+  }
+  for(int i = 0; i < length; i++) {
+    if(ip[i] != '.' && (ip[i] < '0' || ip[i] > '9')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+unsigned long AgentHttpPool::getRequestCount() {
+  return _requestCount;
+}
+
+unsigned long AgentHttpPool::getReuseCount() {
+  return _reuseCount;
+}
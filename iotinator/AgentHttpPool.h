@@ -0,0 +1,100 @@
+/**
+ *  Pool of persistent HTTP connections from the iotinator master to its agents
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <ESP8266HTTPClient.h>
+#include <XIOTModule.h>
+#include "Metrics.h"
+
+// lwIP on ESP8266 allows 5 simultaneous TCP connections, which are shared with the
+// clients of the web server: keep only a few of them open to agents.
+#define HTTP_POOL_SIZE 2
+// Connections unused for this long (ms) are closed
+#define HTTP_POOL_IDLE_TIMEOUT 10000
+// The web server serves nobody while a request to an agent is pending: agents on the
+// Access Point answer within a few tens of ms, don't let a dead one block the master for long
+#define HTTP_POOL_TIMEOUT 2000
+#define HTTP_POOL_IP_MAX_LENGTH 15
+// Buffer used when a response needs to be streamed but the agent can't be reached through the pool
+#define HTTP_POOL_FALLBACK_BUFFER_SIZE (100 + MAX_CUSTOM_DATA_SIZE)
+// Forwarded responses are relayed to the client in chunks of this size
+#define HTTP_PROXY_CHUNK_SIZE 256
+
+typedef struct {
+  HTTPClient http;
+  char ip[HTTP_POOL_IP_MAX_LENGTH + 1];  // empty when slot is free
+  time_t lastUsed;
+  bool busy;
+} pooledConnectionType;
+
+/**
+ * Minimal stream to read a response body into a fixed size buffer.
+ * What does not fit is discarded, but consumed, so that the connection can be reused.
+ */
+class BufferStream:public Stream {
+public:
+  BufferStream(char* buffer, int maxSize);
+  bool isTruncated();
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *data, size_t size) override;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+protected:
+  char* _buffer;
+  int _maxSize;
+  int _size = 0;
+  bool _truncated = false;
+};
+
+/**
+ * Stream relaying what is written to the current client of the web server, in chunks.
+ * The response headers need to be sent before, with an unknown content length.
+ */
+class ProxyStream:public Stream {
+public:
+  ProxyStream(ESP8266WebServer* server, Stream* copy = NULL);
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *data, size_t size) override;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override;
+protected:
+  ESP8266WebServer* _server;
+  Stream* _copy;
+  char _chunk[HTTP_PROXY_CHUNK_SIZE];
+  int _size = 0;
+};
+
+class AgentHttpPool {
+public:
+  AgentHttpPool(XIOTModule* module);
+  void APIGet(const char* ip, const char* path, int* httpCode, char* response = NULL, int maxSize = 0);
+  void APIGet(const char* ip, const char* path, int* httpCode, Stream* response);
+  void APIPost(const char* ip, const char* path, const char* body, int* httpCode, char* response = NULL, int maxSize = 0);
+  int forward(const char* ip, Stream* copy = NULL);
+  void expire(); // close connections idle for too long
+  void closeAll();
+  bool isPoolable(const char* ip);
+  unsigned long getRequestCount();
+  unsigned long getReuseCount();
+  
+protected:
+  XIOTModule* _module;
+  pooledConnectionType _connections[HTTP_POOL_SIZE];
+  unsigned long _requestCount = 0;
+  unsigned long _reuseCount = 0;
+#ifdef METRICS_ENABLED
+  int _forwardMetricId;  // master to agent hop, until the response headers are received
+  int _relayMetricId;    // agent to client hop, for the response body
+#endif
+  pooledConnectionType* _acquire(const char* ip, const char* path);
+  void _release(pooledConnectionType* connection);
+  void _close(pooledConnectionType* connection);
+  void _readResponse(pooledConnectionType* connection, int httpCode, Stream* response);
+};
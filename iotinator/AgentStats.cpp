@@ -0,0 +1,97 @@
+/**
+ *  Liveness statistics of an Agent module registered in iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "AgentStats.h"
+
+void AgentStats::success(uint32_t rtt) {
+  _record(true);
+  _rttLast = rtt;
+  if(rtt > _rttMax) {
+    _rttMax = rtt;
+  }
+  // First value initializes the average
+  if(_rttEwma == 0) {
+    _rttEwma = rtt * 8;
+  } else {
+    _rttEwma = _rttEwma - (_rttEwma / 8) + rtt;
+  }
+  int bucket = 0;
+  while(bucket < RTT_HISTOGRAM_BUCKETS - 1 && rtt >= (16UL << bucket)) {
+    bucket ++;
+  }
+  if(_rttHistogram[bucket] < 0xFFFF) {
+    _rttHistogram[bucket] ++;
+  }
+}
+
+void AgentStats::heartbeat() {
+  _record(true);
+}
+
+void AgentStats::failure() {
+  _record(false);
+}
+
+void AgentStats::_record(bool success) {
+  _history = (_history << 1) | (success ? 1 : 0);
+  if(_historySize < AVAILABILITY_LONG_WINDOW) {
+    _historySize ++;
+  }
+  if(success) {
+    _successCount ++;
+  } else {
+    _failureCount ++;
+  }
+}
+
+uint32_t AgentStats::getRttLast() {
+  return _rttLast;
+}
+
+uint32_t AgentStats::getRttAvg() {
+  return _rttEwma / 8;
+}
+
+uint32_t AgentStats::getRttMax() {
+  return _rttMax;
+}
+
+uint32_t AgentStats::getSuccessCount() {
+  return _successCount;
+}
+
+uint32_t AgentStats::getFailureCount() {
+  return _failureCount;
+}
+
+// Returns -1 if no check was done yet
+int AgentStats::getAvailability(int window) {
+  int size = _historySize < window ? _historySize : window;
+  if(size == 0) {
+    return -1;
+  }
+  int successes = 0;
+  for(int i = 0; i < size; i++) {
+    if(_history & ((uint64_t)1 << i)) {
+      successes ++;
+    }
+  }
+  return (successes * 100) / size;
+}
+
+void AgentStats::toJson(JsonObject& root) {
+  root[JSON_TAG_RTT_LAST] = _rttLast;
+  root[JSON_TAG_RTT_AVG] = getRttAvg();
+  root[JSON_TAG_RTT_MAX] = _rttMax;
+  root[JSON_TAG_SUCCESS_COUNT] = _successCount;
+  root[JSON_TAG_FAILURE_COUNT] = _failureCount;
+  root[JSON_TAG_AVAILABILITY_SHORT] = getAvailability(AVAILABILITY_SHORT_WINDOW);
+  root[JSON_TAG_AVAILABILITY_LONG] = getAvailability(AVAILABILITY_LONG_WINDOW);
+  JsonArray& histogram = root.createNestedArray(JSON_TAG_RTT_HISTOGRAM);
+  for(int i = 0; i < RTT_HISTOGRAM_BUCKETS; i++) {
+    histogram.add(_rttHistogram[i]);
+  }
+}
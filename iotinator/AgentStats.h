@@ -0,0 +1,52 @@
+/**
+ *  Liveness statistics of an Agent module registered in iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Ping round trip time histogram: bucket i counts rtt < 2^(i+4) ms, last one counts the slower ones
+#define RTT_HISTOGRAM_BUCKETS 8
+// Availability is computed on the outcome of the last checks (ping or heartbeat)
+#define AVAILABILITY_SHORT_WINDOW 16
+#define AVAILABILITY_LONG_WINDOW 64
+
+#define JSON_TAG_RTT_LAST "rttLast"
+#define JSON_TAG_RTT_AVG "rttAvg"
+#define JSON_TAG_RTT_MAX "rttMax"
+#define JSON_TAG_RTT_HISTOGRAM "rttHistogram"
+#define JSON_TAG_SUCCESS_COUNT "success"
+#define JSON_TAG_FAILURE_COUNT "failure"
+#define JSON_TAG_AVAILABILITY_SHORT "availability16"
+#define JSON_TAG_AVAILABILITY_LONG "availability64"
+
+// Buffer size for the stats of one agent
+#define JSON_AGENT_STATS_SIZE (JSON_OBJECT_SIZE(8) + JSON_ARRAY_SIZE(RTT_HISTOGRAM_BUCKETS))
+
+class AgentStats {
+public:
+  void success(uint32_t rtt);  // successful ping, rtt in ms
+  void heartbeat();  // successful check with no rtt
+  void failure();
+  uint32_t getRttLast();
+  uint32_t getRttAvg();
+  uint32_t getRttMax();
+  uint32_t getSuccessCount();
+  uint32_t getFailureCount();
+  int getAvailability(int window);  // percentage of successful checks among the last ones
+  void toJson(JsonObject& root);
+  
+protected:
+  uint32_t _rttLast = 0;
+  uint32_t _rttEwma = 0;  // exponentially weighted moving average, 1/8 weight for new values, scaled by 8
+  uint32_t _rttMax = 0;
+  uint32_t _successCount = 0;
+  uint32_t _failureCount = 0;
+  uint16_t _rttHistogram[RTT_HISTOGRAM_BUCKETS] = {0};
+  uint64_t _history = 0;  // bit 0 is the outcome of the last check, 1 for success
+  uint8_t _historySize = 0;
+  void _record(bool success);
+};
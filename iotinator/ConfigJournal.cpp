@@ -0,0 +1,248 @@
+/**
+ *  Log structured storage of the master config in flash, safe against power cuts
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "ConfigJournal.h"
+#include "Fnv1a.h"
+#include <spi_flash.h>
+
+extern "C" uint32_t _SPIFFS_start;
+extern "C" uint32_t _SPIFFS_end;
+
+#define FLASH_MAPPED_ADDRESS 0x40200000
+#define PADDED_LENGTH(length) (((length) + 3) & ~3)
+
+/**
+ * The journal is a list of records, each holding the new value of a range of the data structure.
+ * Replaying the records of the active sector on the data structure rebuilds it: the first record
+ * of a sector is always a snapshot of the whole structure, written when the sector was started.
+ */
+ConfigJournal::ConfigJournal(uint8_t* data, uint16_t size) {
+  _data = data;
+  _size = size;
+}
+
+/**
+ * Locate the journal sectors. Returns false if the flash layout has no room for them, in which
+ * case the journal must not be used.
+ */
+bool ConfigJournal::begin() {
+  uint32_t start = (uint32_t)(uintptr_t)&_SPIFFS_start - FLASH_MAPPED_ADDRESS;
+  uint32_t end = (uint32_t)(uintptr_t)&_SPIFFS_end - FLASH_MAPPED_ADDRESS;
+  uint32_t needed = sizeof(configJournalHeaderType) + sizeof(configJournalRecordType) + PADDED_LENGTH(_size);
+  if(end - start < CONFIG_JOURNAL_SECTORS * SPI_FLASH_SEC_SIZE || needed > SPI_FLASH_SEC_SIZE) {
+    Serial.println("No room for the config journal");
+    _firstSector = 0;
+    return false;
+  }
+  _firstSector = end / SPI_FLASH_SEC_SIZE - CONFIG_JOURNAL_SECTORS;
+  return true;
+}
+
+// The journal is ready once loaded or compacted
+bool ConfigJournal::isReady() {
+  return _active >= 0;
+}
+
+/**
+ * Rebuild the data structure from the active sector. Returns false if no valid sector was found.
+ * version and dataSize are set to the ones of the data structure saved in the journal: if the size
+ * doesn't match the current one, nothing is replayed, see replay().
+ */
+bool ConfigJournal::load(uint16_t* version, uint16_t* dataSize) {
+  configJournalHeaderType header;
+  configJournalHeaderType activeHeader;
+  _active = -1;
+  if(_firstSector == 0) return false;
+  for(int i = 0; i < CONFIG_JOURNAL_SECTORS; i++) {
+    if(_readHeader(i, &header) && (_active < 0 || (int32_t)(header.sequence - activeHeader.sequence) > 0)) {
+      _active = i;
+      activeHeader = header;
+    }
+  }
+  if(_active < 0) return false;
+  _sequence = activeHeader.sequence;
+  _version = activeHeader.version;
+  _dataSize = activeHeader.dataSize;
+  *version = _version;
+  *dataSize = _dataSize;
+  if(_dataSize != _size) {
+    // Records written for another layout can't be appended to
+    _writeOffset = SPI_FLASH_SEC_SIZE;
+    return true;
+  }
+  _writeOffset = _replay(_active, _data, _dataSize);
+  Serial.printf("Config journal: sector %d, %d bytes used\n", _active, _writeOffset);
+  return true;
+}
+
+/**
+ * Rebuild the data structure saved in the active sector in another buffer, of the size given by load().
+ * Used to read a structure saved with a previous layout.
+ */
+bool ConfigJournal::replay(uint8_t* data, uint16_t dataSize) {
+  if(_active < 0 || dataSize != _dataSize) return false;
+  _replay(_active, data, dataSize);
+  return true;
+}
+
+/**
+ * Append a record with the current value of a range of the data structure.
+ * When the active sector is full, the journal is compacted instead.
+ */
+bool ConfigJournal::append(uint16_t offset, uint16_t length) {
+  if(_active < 0) return false;
+  if(offset + length > _size) return false;
+  uint32_t recordSize = sizeof(configJournalRecordType) + PADDED_LENGTH(length);
+  if(_writeOffset + recordSize > SPI_FLASH_SEC_SIZE) {
+    return compact(_version);
+  }
+  if(!_writeRecord(_active, _writeOffset, offset, length)) {
+    // Don't write again over a partially written record
+    _writeOffset = SPI_FLASH_SEC_SIZE;
+    return false;
+  }
+  _writeOffset += recordSize;
+  return true;
+}
+
+/**
+ * Write the whole data structure in the other sector, which then becomes the active one.
+ * Its header is written last: if power is lost before, the previous sector stays the active one.
+ */
+bool ConfigJournal::compact(uint16_t version) {
+  if(_firstSector == 0) return false;
+  int sector = _active < 0 ? 0 : (_active + 1) % CONFIG_JOURNAL_SECTORS;
+  _eraseCount ++;
+  if(!ESP.flashEraseSector(_firstSector + sector)) {
+    Serial.println("Config journal erase failed");
+    return false;
+  }
+  uint32_t offset = sizeof(configJournalHeaderType);
+  if(!_writeRecord(sector, offset, 0, _size)) return false;
+  configJournalHeaderType header;
+  header.magic = CONFIG_JOURNAL_MAGIC;
+  header.sequence = _sequence + 1;
+  header.version = version;
+  header.dataSize = _size;
+  header.checksum = fnv1a(FNV1A_BASIS, &header, offsetof(configJournalHeaderType, checksum));
+  _writeCount ++;
+  if(!ESP.flashWrite(_address(sector, 0), (uint32_t*)&header, sizeof(header))) {
+    Serial.println("Config journal write failed");
+    return false;
+  }
+  _active = sector;
+  _sequence = header.sequence;
+  _version = version;
+  _dataSize = _size;
+  _writeOffset = offset + sizeof(configJournalRecordType) + PADDED_LENGTH(_size);
+  return true;
+}
+
+/**
+ * Compacting in advance, when the loop is idle, avoids compacting when a save is requested.
+ */
+bool ConfigJournal::needsCompaction() {
+  if(_active < 0) return false;
+  return _writeOffset * 100 > (uint32_t)SPI_FLASH_SEC_SIZE * CONFIG_JOURNAL_COMPACT_THRESHOLD;
+}
+
+unsigned long ConfigJournal::getWriteCount() {
+  return _writeCount;
+}
+
+unsigned long ConfigJournal::getEraseCount() {
+  return _eraseCount;
+}
+
+uint32_t ConfigJournal::_address(int sector, uint32_t offset) {
+  return (_firstSector + sector) * SPI_FLASH_SEC_SIZE + offset;
+}
+
+bool ConfigJournal::_readHeader(int sector, configJournalHeaderType* header) {
+  if(!ESP.flashRead(_address(sector, 0), (uint32_t*)header, sizeof(configJournalHeaderType))) return false;
+  if(header->magic != CONFIG_JOURNAL_MAGIC) return false;
+  return header->checksum == fnv1a(FNV1A_BASIS, header, offsetof(configJournalHeaderType, checksum));
+}
+
+/**
+ * Apply the valid records of a sector to a data structure, and return the offset following the
+ * last one. The journal ends at the first erased or invalid record: a record partially written
+ * when power was lost is ignored.
+ */
+int ConfigJournal::_replay(int sector, uint8_t* data, uint16_t dataSize) {
+  uint32_t buffer[CONFIG_JOURNAL_CHUNK_SIZE / 4];
+  configJournalRecordType record;
+  uint32_t offset = sizeof(configJournalHeaderType);
+  while(offset + sizeof(configJournalRecordType) <= SPI_FLASH_SEC_SIZE) {
+    uint32_t address = _address(sector, offset);
+    if(!_checkRecord(address, &record, dataSize)) break;
+    address += sizeof(configJournalRecordType);
+    for(uint16_t pos = 0; pos < record.length; pos += CONFIG_JOURNAL_CHUNK_SIZE) {
+      uint16_t size = min(CONFIG_JOURNAL_CHUNK_SIZE, record.length - pos);
+      ESP.flashRead(address + pos, buffer, PADDED_LENGTH(size));
+      memcpy(data + record.offset + pos, buffer, size);
+    }
+    offset += sizeof(configJournalRecordType) + PADDED_LENGTH(record.length);
+  }
+  // Flash after a partially written record is not erased anymore: the sector is considered full
+  if(offset + sizeof(configJournalRecordType) <= SPI_FLASH_SEC_SIZE
+     && (record.offset != 0xFFFF || record.length != 0xFFFF || record.checksum != 0xFFFFFFFF)) {
+    Serial.println("Config journal: partial record ignored");
+    return SPI_FLASH_SEC_SIZE;
+  }
+  return offset;
+}
+
+/**
+ * Read the header of the record at the given address and check its checksum
+ */
+bool ConfigJournal::_checkRecord(uint32_t address, configJournalRecordType* record, uint16_t dataSize) {
+  uint32_t buffer[CONFIG_JOURNAL_CHUNK_SIZE / 4];
+  uint32_t sectorEnd = (address / SPI_FLASH_SEC_SIZE + 1) * SPI_FLASH_SEC_SIZE;
+  if(!ESP.flashRead(address, (uint32_t*)record, sizeof(configJournalRecordType))) return false;
+  if(record->offset == 0xFFFF || record->length == 0) return false;
+  if(record->offset + record->length > dataSize) return false;
+  address += sizeof(configJournalRecordType);
+  if(address + PADDED_LENGTH(record->length) > sectorEnd) return false;
+  uint32_t hash = fnv1a(FNV1A_BASIS, record, offsetof(configJournalRecordType, checksum));
+  for(uint16_t pos = 0; pos < record->length; pos += CONFIG_JOURNAL_CHUNK_SIZE) {
+    uint16_t size = min(CONFIG_JOURNAL_CHUNK_SIZE, record->length - pos);
+    if(!ESP.flashRead(address + pos, buffer, PADDED_LENGTH(size))) return false;
+    hash = fnv1a(hash, buffer, size);
+  }
+  return hash == record->checksum;
+}
+
+/**
+ * Write a record for a range of the data structure. Data are copied to an aligned buffer,
+ * as required by the flash API.
+ */
+bool ConfigJournal::_writeRecord(int sector, uint32_t offset, uint16_t dataOffset, uint16_t length) {
+  uint32_t buffer[CONFIG_JOURNAL_CHUNK_SIZE / 4];
+  configJournalRecordType record;
+  record.offset = dataOffset;
+  record.length = length;
+  record.checksum = _recordChecksum(&record, _data + dataOffset);
+  uint32_t address = _address(sector, offset);
+  _writeCount ++;
+  bool success = ESP.flashWrite(address, (uint32_t*)&record, sizeof(record));
+  address += sizeof(record);
+  for(uint16_t pos = 0; success && pos < length; pos += CONFIG_JOURNAL_CHUNK_SIZE) {
+    uint16_t size = min(CONFIG_JOURNAL_CHUNK_SIZE, length - pos);
+    memset(buffer, 0xFF, sizeof(buffer));
+    memcpy(buffer, _data + dataOffset + pos, size);
+    success = ESP.flashWrite(address + pos, buffer, PADDED_LENGTH(size));
+  }
+  if(!success) {
+    Serial.println("Config journal write failed");
+  }
+  return success;
+}
+
+uint32_t ConfigJournal::_recordChecksum(configJournalRecordType* record, const uint8_t* data) {
+  uint32_t hash = fnv1a(FNV1A_BASIS, record, offsetof(configJournalRecordType, checksum));
+  return fnv1a(hash, data, record->length);
+}
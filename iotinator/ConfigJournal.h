@@ -0,0 +1,65 @@
+/**
+ *  Log structured storage of the master config in flash, safe against power cuts
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// The journal uses the last sectors before the EEPROM sector, which belong to the SPIFFS area,
+// unused by the master. Sectors are used alternately: when one is full, the config is written
+// in the other one, which becomes the active one.
+#define CONFIG_JOURNAL_SECTORS 2
+#define CONFIG_JOURNAL_MAGIC 0x4A435849  // "IXCJ"
+// Above this use of the active sector, the journal is compacted when the loop is idle
+#define CONFIG_JOURNAL_COMPACT_THRESHOLD 75  // %
+// Flash is written by chunks from an aligned buffer
+#define CONFIG_JOURNAL_CHUNK_SIZE 64
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;  // the valid sector with the highest sequence is the active one
+  uint16_t version;   // version of the data structure
+  uint16_t dataSize;  // size of the data structure
+  uint32_t checksum;
+} configJournalHeaderType;
+
+// Followed by length bytes to write at offset in the data structure, padded to 4 bytes
+typedef struct {
+  uint16_t offset;  // 0xFFFF (erased flash) for the end of the journal
+  uint16_t length;
+  uint32_t checksum;
+} configJournalRecordType;
+
+class ConfigJournal {
+public:
+  ConfigJournal(uint8_t* data, uint16_t size);
+  bool begin();
+  bool isReady();
+  bool load(uint16_t* version, uint16_t* dataSize);
+  bool replay(uint8_t* data, uint16_t dataSize);
+  bool append(uint16_t offset, uint16_t length);
+  bool compact(uint16_t version);
+  bool needsCompaction();
+  unsigned long getWriteCount();
+  unsigned long getEraseCount();
+  
+protected:
+  uint8_t* _data;
+  uint16_t _size;
+  uint32_t _firstSector = 0;  // 0 when journal can't be used
+  int _active = -1;           // index of the active sector, -1 if none
+  uint32_t _sequence = 0;
+  uint16_t _version = 0;
+  uint32_t _writeOffset = 0;  // in the active sector
+  unsigned long _writeCount = 0;
+  unsigned long _eraseCount = 0;
+  uint32_t _address(int sector, uint32_t offset);
+  bool _readHeader(int sector, configJournalHeaderType* header);
+  uint16_t _dataSize = 0;     // size of the data structure saved in the active sector
+  int _replay(int sector, uint8_t* data, uint16_t dataSize);
+  bool _checkRecord(uint32_t address, configJournalRecordType* record, uint16_t dataSize);
+  bool _writeRecord(int sector, uint32_t offset, uint16_t dataOffset, uint16_t length);
+  uint32_t _recordChecksum(configJournalRecordType* record, const uint8_t* data);
+};
@@ -0,0 +1,33 @@
+/**
+ *  Web server handler for the routes the master serves in some cases only
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "FallThroughHandler.h"
+
+FallThroughHandler::FallThroughHandler(const char* uri, HTTPMethod method, fallThroughHandlerFunction handler) {
+  _uri = uri;
+  _method = method;
+  _handler = handler;
+}
+
+bool FallThroughHandler::canHandle(HTTPMethod method, String uri) {
+  return (_method == HTTP_ANY || _method == method) && uri == _uri;
+}
+
+/**
+ * Returns false when nobody handled the request: the web server then answers with its
+ * not found handler.
+ */
+bool FallThroughHandler::handle(ESP8266WebServer& server, HTTPMethod method, String uri) {
+  if(_handler()) {
+    return true;
+  }
+  for(RequestHandler* handler = next(); handler != NULL; handler = handler->next()) {
+    if(handler->canHandle(method, uri)) {
+      return handler->handle(server, method, uri);
+    }
+  }
+  return false;
+}
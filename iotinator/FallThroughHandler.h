@@ -0,0 +1,29 @@
+/**
+ *  Web server handler for the routes the master serves in some cases only
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <ESP8266WebServer.h>
+#include <functional>
+
+// Returns false to decline the request, without sending any response
+typedef std::function<bool()> fallThroughHandlerFunction;
+
+/**
+ * ESP8266WebServer only calls the first handler registered for the method and uri. When this one
+ * declines the request, it's passed on to the next handler registered for them, if any:
+ * master endpoints are registered before XIOTModule's, which then still serves what the master doesn't.
+ */
+class FallThroughHandler:public RequestHandler {
+public:
+  FallThroughHandler(const char* uri, HTTPMethod method, fallThroughHandlerFunction handler);
+  bool canHandle(HTTPMethod method, String uri) override;
+  bool handle(ESP8266WebServer& server, HTTPMethod method, String uri) override;
+  
+protected:
+  String _uri;
+  HTTPMethod _method;
+  fallThroughHandlerFunction _handler;
+};
@@ -0,0 +1,24 @@
+/**
+ *  FNV-1a hash, shared by the agent registration hash and the config journal checksums
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// Initial value of the hash, to be given to the first call
+#define FNV1A_BASIS 2166136261UL
+#define FNV1A_PRIME 16777619UL
+
+/**
+ * Continue hash with size bytes of data: the hash of a sequence of buffers is the same
+ * as the hash of their concatenation.
+ */
+inline uint32_t fnv1a(uint32_t hash, const void* data, int size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  for(int i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV1A_PRIME;
+  }
+  return hash;
+}
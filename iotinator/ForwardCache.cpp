@@ -0,0 +1,80 @@
+/**
+ *  Short lived cache of the agent responses to the GET requests forwarded by the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "ForwardCache.h"
+
+ForwardCache::ForwardCache() {
+  for(int i = 0; i < FORWARD_CACHE_SIZE; i++) {
+    _entries[i].mac[0] = 0;
+  }
+}
+
+/**
+ * Returns the cached response of the agent to a GET on the path, NULL if none or expired.
+ */
+const char* ForwardCache::get(const char* mac, const char* path) {
+  if(FORWARD_CACHE_TTL == 0) return NULL;
+  forwardCacheEntryType* entry = _find(mac, path);
+  if(entry == NULL || (long)(millis() - entry->expiry) >= 0) {
+    _missCount ++;
+    return NULL;
+  }
+  _hitCount ++;
+  return entry->response;
+}
+
+/**
+ * Cache a response, replacing the one for the same agent and path if any,
+ * otherwise the one that expires first.
+ */
+void ForwardCache::put(const char* mac, const char* path, const char* response) {
+  if(FORWARD_CACHE_TTL == 0) return;
+  if(strlen(path) > FORWARD_CACHE_PATH_MAX_LENGTH || strlen(response) > FORWARD_CACHE_RESPONSE_MAX_SIZE) return;
+  forwardCacheEntryType* entry = _find(mac, path);
+  if(entry == NULL) {
+    entry = &_entries[0];
+    for(int i = 0; i < FORWARD_CACHE_SIZE; i++) {
+      if(_entries[i].mac[0] == 0) {
+        entry = &_entries[i];
+        break;
+      }
+      if((long)(_entries[i].expiry - entry->expiry) < 0) {
+        entry = &_entries[i];
+      }
+    }
+  }
+  strcpy(entry->mac, mac);
+  strcpy(entry->path, path);
+  strcpy(entry->response, response);
+  entry->expiry = millis() + FORWARD_CACHE_TTL;
+}
+
+// Forget what was cached for an agent, its data changed
+void ForwardCache::invalidate(const char* mac) {
+  for(int i = 0; i < FORWARD_CACHE_SIZE; i++) {
+    if(strcasecmp(_entries[i].mac, mac) == 0) {
+      _entries[i].mac[0] = 0;
+    }
+  }
+}
+
+forwardCacheEntryType* ForwardCache::_find(const char* mac, const char* path) {
+  for(int i = 0; i < FORWARD_CACHE_SIZE; i++) {
+    forwardCacheEntryType* entry = &_entries[i];
+    if(entry->mac[0] != 0 && strcasecmp(entry->mac, mac) == 0 && strcmp(entry->path, path) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+unsigned long ForwardCache::getHitCount() {
+  return _hitCount;
+}
+
+unsigned long ForwardCache::getMissCount() {
+  return _missCount;
+}
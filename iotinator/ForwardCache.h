@@ -0,0 +1,38 @@
+/**
+ *  Short lived cache of the agent responses to the GET requests forwarded by the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <XIOTModule.h>
+
+// Time (ms) during which a response is served from the cache, 0 to disable the cache
+#define FORWARD_CACHE_TTL 1000
+#define FORWARD_CACHE_SIZE 4
+#define FORWARD_CACHE_PATH_MAX_LENGTH 40
+// Bigger responses are not cached
+#define FORWARD_CACHE_RESPONSE_MAX_SIZE 300
+
+typedef struct {
+  char mac[MAC_ADDR_MAX_LENGTH + 1];  // empty when entry is free
+  char path[FORWARD_CACHE_PATH_MAX_LENGTH + 1];
+  char response[FORWARD_CACHE_RESPONSE_MAX_SIZE + 1];
+  unsigned long expiry;
+} forwardCacheEntryType;
+
+class ForwardCache {
+public:
+  ForwardCache();
+  const char* get(const char* mac, const char* path);
+  void put(const char* mac, const char* path, const char* response);
+  void invalidate(const char* mac);
+  unsigned long getHitCount();
+  unsigned long getMissCount();
+  
+protected:
+  forwardCacheEntryType _entries[FORWARD_CACHE_SIZE];
+  unsigned long _hitCount = 0;
+  unsigned long _missCount = 0;
+  forwardCacheEntryType* _find(const char* mac, const char* path);
+};
@@ -0,0 +1,120 @@
+/**
+ *  Class receiving the UDP heartbeats sent by agent modules to the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "Heartbeat.h"
+
+Heartbeat::Heartbeat(heartbeatHandler handler) {
+  _handler = handler;
+}
+
+void Heartbeat::begin() {
+  _udp.begin(HEARTBEAT_PORT);
+  Serial.printf("Listening to heartbeats on port %d\n", HEARTBEAT_PORT);
+}
+
+/**
+ * Process the datagrams already received, if any.
+ * Returns the number of valid heartbeats processed.
+ */
+int Heartbeat::handle() {
+  int processed = 0;
+  for(int i = 0; i < HEARTBEAT_MAX_PER_HANDLE; i++) {
+    int size = _udp.parsePacket();
+    if(size <= 0) break;
+    if(size > HEARTBEAT_MAX_SIZE) {
+      _rejectedCount ++;
+      _udp.flush();
+      continue;
+    }
+    _udp.read(_packet, size);
+    if(_ingest(size)) {
+      processed ++;
+    }
+  }
+  return processed;
+}
+
+bool Heartbeat::_ingest(int size) {
+  if(size < HEARTBEAT_HEADER_SIZE
+     || _packet[0] != HEARTBEAT_MAGIC_0 || _packet[1] != HEARTBEAT_MAGIC_1
+     || _packet[2] != HEARTBEAT_PROTOCOL_VERSION || _packet[3] != HEARTBEAT_TYPE_BEAT) {
+    _rejectedCount ++;
+    return false;
+  }
+  uint32_t heap = _read32(12);
+  int customSize = _read16(16);
+  if(HEARTBEAT_HEADER_SIZE + customSize > size) {
+    _rejectedCount ++;
+    return false;
+  }
+  const char* custom = customSize > 0 ? (const char*)_packet + HEARTBEAT_HEADER_SIZE : NULL;
+  if(!_handler(_packet + 6, heap, custom, customSize)) {
+    // Not registered (yet): module will register, heartbeat is just ignored
+    _rejectedCount ++;
+    return false;
+  }
+  _receivedCount ++;
+  if(_sweepSequence != 0 && _read16(4) == _sweepSequence) {
+    _sweepAnswerCount ++;
+  }
+  return true;
+}
+
+/**
+ * Broadcast a probe on the Access Point subnet: all agents supporting heartbeats answer at once,
+ * which costs about one round trip for the whole swarm instead of one per agent.
+ * Answers are ingested by handle(), until the sweep window is over.
+ */
+void Heartbeat::sweep() {
+  uint8_t probe[HEARTBEAT_HEADER_SIZE];
+  memset(probe, 0, HEARTBEAT_HEADER_SIZE);
+  // 0 is the sequence number of spontaneous heartbeats
+  if(++_sweepSequence == 0) {
+    _sweepSequence = 1;
+  }
+  probe[0] = HEARTBEAT_MAGIC_0;
+  probe[1] = HEARTBEAT_MAGIC_1;
+  probe[2] = HEARTBEAT_PROTOCOL_VERSION;
+  probe[3] = HEARTBEAT_TYPE_PROBE;
+  probe[4] = _sweepSequence & 0xFF;
+  probe[5] = _sweepSequence >> 8;
+  WiFi.softAPmacAddress(probe + 6);
+  
+  IPAddress apIP = WiFi.softAPIP();
+  IPAddress broadcastIP(apIP[0], apIP[1], apIP[2], 255);
+  _sweepStart = millis();
+  _sweepAnswerCount = 0;
+  _udp.beginPacket(broadcastIP, HEARTBEAT_PORT);
+  _udp.write(probe, HEARTBEAT_HEADER_SIZE);
+  _udp.endPacket();
+}
+
+time_t Heartbeat::getSweepStart() {
+  return _sweepStart;
+}
+
+int Heartbeat::getSweepAnswerCount() {
+  return _sweepAnswerCount;
+}
+
+uint16_t Heartbeat::_read16(int offset) {
+  return _packet[offset] | (_packet[offset + 1] << 8);
+}
+
+uint32_t Heartbeat::_read32(int offset) {
+  return (uint32_t)_packet[offset] 
+       | ((uint32_t)_packet[offset + 1] << 8)
+       | ((uint32_t)_packet[offset + 2] << 16)
+       | ((uint32_t)_packet[offset + 3] << 24);
+}
+
+unsigned long Heartbeat::getReceivedCount() {
+  return _receivedCount;
+}
+
+unsigned long Heartbeat::getRejectedCount() {
+  return _rejectedCount;
+}
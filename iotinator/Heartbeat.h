@@ -0,0 +1,70 @@
+/**
+ *  Class receiving the UDP heartbeats sent by agent modules to the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <XIOTModule.h>
+#include <functional>
+
+// Port advertised to agents in /api/config. Agents not sending heartbeats keep being pinged over HTTP.
+#define HEARTBEAT_PORT 4210
+#define JSON_TAG_HEARTBEAT_PORT "heartbeatPort"
+
+/**
+ * Heartbeat datagram layout, multi-byte values are little endian:
+ *  offset size
+ *     0     2   magic: 'X' 'H'
+ *     2     1   protocol version
+ *     3     1   type
+ *     4     2   sequence number (0 for spontaneous heartbeats)
+ *     6     6   MAC address of the agent
+ *    12     4   free heap
+ *    16     2   custom data size
+ *    18     n   custom data (not null terminated)
+ */
+#define HEARTBEAT_MAGIC_0 'X'
+#define HEARTBEAT_MAGIC_1 'H'
+#define HEARTBEAT_PROTOCOL_VERSION 1
+#define HEARTBEAT_TYPE_BEAT 1
+#define HEARTBEAT_TYPE_PROBE 2   // sent by master, agents answer with a heartbeat carrying the same sequence number
+#define HEARTBEAT_HEADER_SIZE 18
+#define HEARTBEAT_MAX_SIZE (HEARTBEAT_HEADER_SIZE + MAX_CUSTOM_DATA_SIZE)
+
+// Time (ms) during which answers to a sweep probe are collected before falling back to HTTP ping
+#define HEARTBEAT_SWEEP_WINDOW 300
+
+// Maximum number of datagrams processed in one call to handle(), so that a burst does not hold the loop
+#define HEARTBEAT_MAX_PER_HANDLE 8
+
+// Called with each valid heartbeat, custom data is not null terminated.
+// Returns false if the agent is not registered.
+typedef std::function<bool(const uint8_t* mac, uint32_t heap, const char* custom, int customSize)> heartbeatHandler;
+
+class Heartbeat {
+public:
+  Heartbeat(heartbeatHandler handler);
+  void begin();
+  int handle();  // ingest pending datagrams, never waits for one
+  void sweep();  // broadcast a probe to every agent on the Access Point
+  time_t getSweepStart();
+  int getSweepAnswerCount();
+  unsigned long getReceivedCount();
+  unsigned long getRejectedCount();
+  
+protected:
+  WiFiUDP _udp;
+  heartbeatHandler _handler;
+  uint8_t _packet[HEARTBEAT_MAX_SIZE];
+  unsigned long _receivedCount = 0;
+  unsigned long _rejectedCount = 0;
+  uint16_t _sweepSequence = 0;
+  time_t _sweepStart = 0;
+  int _sweepAnswerCount = 0;
+  bool _ingest(int size);
+  uint16_t _read16(int offset);
+  uint32_t _read32(int offset);
+};
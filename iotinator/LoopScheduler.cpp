@@ -0,0 +1,173 @@
+/**
+ *  Cooperative scheduler for the tasks run in the master module loop
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "LoopScheduler.h"
+
+// The clock can be replaced, to run the scheduler with a simulated time
+LoopScheduler::LoopScheduler(unsigned long (*clock)()) {
+  _clock = clock;
+}
+
+int LoopScheduler::addPolling(const char* name, taskFunction function, uint8_t priority, unsigned long budget) {
+  return _add(name, function, 0, 0, priority, budget, false);
+}
+
+// First run will occur one period from now
+int LoopScheduler::addPeriodic(const char* name, taskFunction function, unsigned long period, uint8_t priority, unsigned long budget) {
+  return _add(name, function, period, period, priority, budget, false);
+}
+
+int LoopScheduler::addOneShot(const char* name, taskFunction function, unsigned long delay, uint8_t priority) {
+  return _add(name, function, 0, delay, priority, 0, true);
+}
+
+/**
+ * A slot freed by a finished one shot task is reused, so that ids stay stable and tasks can be
+ * added while the scheduler runs.
+ * Returns the task id, or -1 if too many tasks.
+ */
+int LoopScheduler::_add(const char* name, taskFunction function, unsigned long period, unsigned long delay, uint8_t priority, unsigned long budget, bool oneShot) {
+  int id = -1;
+  for(int i = 0; i < _taskCount; i++) {
+    if(!_tasks[i].active) {
+      id = i;
+      break;
+    }
+  }
+  if(id == -1) {
+    if(_taskCount >= MAX_TASKS) {
+      Serial.printf("Too many tasks, can't add %s\n", name);
+      return -1;
+    }
+    id = _taskCount++;
+  }
+  taskType* task = &_tasks[id];
+  task->name = name;
+  task->function = function;
+  task->period = period;
+  task->nextRun = _clock() + delay;
+  task->budget = budget;
+  task->priority = priority;
+  task->oneShot = oneShot;
+  task->active = true;
+  task->runCount = 0;
+  task->overrunCount = 0;
+  task->maxDuration = 0;
+#ifdef METRICS_ENABLED
+  task->metricId = metrics.add(name);
+#endif
+  return id;
+}
+
+void LoopScheduler::cancel(int id) {
+  if(id >= 0 && id < _taskCount) {
+    _tasks[id].active = false;
+  }
+}
+
+void LoopScheduler::setLoopBudget(unsigned long budget) {
+  _loopBudget = budget;
+}
+
+bool LoopScheduler::_isDue(taskType* task, unsigned long now) {
+  if(!task->active) return false;
+  if(task->period == 0 && !task->oneShot) return true;
+  // Signed difference handles the clock wrap around
+  return (long)(now - task->nextRun) >= 0;
+}
+
+/**
+ * Run the due tasks, highest priority first, tasks of same priority in the order they were added
+ */
+void LoopScheduler::run() {
+  unsigned long loopStart = _clock();
+  int priority = -1;
+  while(true) {
+    // Find the next priority level to process
+    int nextPriority = 256;
+    for(int i = 0; i < _taskCount; i++) {
+      if(_tasks[i].active && _tasks[i].priority > priority && _tasks[i].priority < nextPriority) {
+        nextPriority = _tasks[i].priority;
+      }
+    }
+    if(nextPriority == 256) break;
+    priority = nextPriority;
+    for(int i = 0; i < _taskCount; i++) {
+      if(_tasks[i].priority == priority) {
+        _runTask(&_tasks[i], loopStart);
+      }
+    }
+  }
+}
+
+void LoopScheduler::_runTask(taskType* task, unsigned long loopStart) {
+  unsigned long now = _clock();
+  if(!_isDue(task, now)) return;
+  // Out of budget: lower priority tasks stay due, and will run at next iteration
+  if(task->priority > PRIORITY_HIGH && (now - loopStart) > _loopBudget) return;
+  if(task->oneShot) {
+    task->active = false;
+  } else if(task->period > 0) {
+    task->nextRun = now + task->period;
+  }
+  {
+    METRIC_SCOPE(task->metricId);
+    task->function();
+  }
+  unsigned long duration = _clock() - now;
+  task->runCount ++;
+  if(duration > task->maxDuration) {
+    task->maxDuration = duration;
+  }
+  if(task->budget > 0 && duration > task->budget) {
+    task->overrunCount ++;
+    Serial.printf("Task %s over budget: %lums\n", task->name, duration);
+  }
+}
+
+/**
+ * Time before the next periodic or one shot task is due, at most maxTime
+ */
+unsigned long LoopScheduler::timeToNextDeadline(unsigned long maxTime) {
+  unsigned long now = _clock();
+  unsigned long result = maxTime;
+  for(int i = 0; i < _taskCount; i++) {
+    taskType* task = &_tasks[i];
+    if(!task->active || (task->period == 0 && !task->oneShot)) continue;
+    if((long)(now - task->nextRun) >= 0) {
+      return 0;
+    }
+    if(task->nextRun - now < result) {
+      result = task->nextRun - now;
+    }
+  }
+  return result;
+}
+
+/**
+ * Sleep until the next task is due, at most maxSleep.
+ * If a wakeUp function is given, it's called every ms, and sleep ends as soon as it returns true.
+ */
+void LoopScheduler::sleep(unsigned long maxSleep, bool (*wakeUp)()) {
+  unsigned long duration = timeToNextDeadline(maxSleep);
+  if(wakeUp == NULL) {
+    delay(duration);
+    return;
+  }
+  unsigned long start = _clock();
+  while(_clock() - start < duration) {
+    if(wakeUp()) return;
+    delay(1);
+  }
+}
+
+int LoopScheduler::getTaskCount() {
+  return _taskCount;
+}
+
+taskType* LoopScheduler::getTask(int id) {
+  return &_tasks[id];
+}
@@ -0,0 +1,63 @@
+/**
+ *  Cooperative scheduler for the tasks run in the master module loop
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "Metrics.h"
+
+#define MAX_TASKS 20
+
+// Tasks with a lower value run first in a loop iteration
+#define PRIORITY_HIGH 0
+#define PRIORITY_NORMAL 10
+#define PRIORITY_LOW 20
+
+// Once the loop iteration has lasted this long (ms), due tasks that are not high priority
+// are postponed to the next iteration
+#define DEFAULT_LOOP_BUDGET 50
+
+typedef void (*taskFunction)();
+
+typedef struct {
+  const char* name;
+  taskFunction function;
+  unsigned long period;   // 0 for polling tasks, run at each iteration
+  unsigned long nextRun;
+  unsigned long budget;   // ms, 0 if none. Overruns are counted and logged
+  uint8_t priority;
+  bool oneShot;
+  bool active;
+  unsigned long runCount;
+  unsigned long overrunCount;
+  unsigned long maxDuration;
+#ifdef METRICS_ENABLED
+  int metricId;
+#endif
+} taskType;
+
+class LoopScheduler {
+public:
+  LoopScheduler(unsigned long (*clock)() = millis);
+  int addPolling(const char* name, taskFunction function, uint8_t priority = PRIORITY_NORMAL, unsigned long budget = 0);
+  int addPeriodic(const char* name, taskFunction function, unsigned long period, uint8_t priority = PRIORITY_NORMAL, unsigned long budget = 0);
+  int addOneShot(const char* name, taskFunction function, unsigned long delay, uint8_t priority = PRIORITY_NORMAL);
+  void cancel(int id);
+  void setLoopBudget(unsigned long budget);
+  void run();  // run the tasks that are due, by priority
+  unsigned long timeToNextDeadline(unsigned long maxTime);  // polling tasks are not taken into account
+  void sleep(unsigned long maxSleep, bool (*wakeUp)() = NULL);
+  int getTaskCount();
+  taskType* getTask(int id);
+  
+protected:
+  unsigned long (*_clock)();
+  taskType _tasks[MAX_TASKS];
+  int _taskCount = 0;
+  unsigned long _loopBudget = DEFAULT_LOOP_BUDGET;
+  int _add(const char* name, taskFunction function, unsigned long period, unsigned long delay, uint8_t priority, unsigned long budget, bool oneShot);
+  bool _isDue(taskType* task, unsigned long now);
+  void _runTask(taskType* task, unsigned long loopStart);
+};
@@ -0,0 +1,108 @@
+/**
+ *  Latency instrumentation of the master module loop tasks and http routes
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "Metrics.h"
+
+#ifdef METRICS_ENABLED
+Metrics metrics;
+
+void LatencyHistogram::record(uint32_t us) {
+  if(_count == 0 || us < _min) {
+    _min = us;
+  }
+  if(us > _max) {
+    _max = us;
+  }
+  _count ++;
+  _total += us;
+  int bucket = 0;
+  while(bucket < LATENCY_BUCKETS - 1 && (us >> bucket) != 0) {
+    bucket ++;
+  }
+  if(_buckets[bucket] < 0xFFFF) {
+    _buckets[bucket] ++;
+  }
+}
+
+uint32_t LatencyHistogram::getCount() {
+  return _count;
+}
+
+uint32_t LatencyHistogram::getMin() {
+  return _min;
+}
+
+uint32_t LatencyHistogram::getAvg() {
+  return _count == 0 ? 0 : _total / _count;
+}
+
+uint32_t LatencyHistogram::getMax() {
+  return _max;
+}
+
+uint32_t LatencyHistogram::getPercentile(int percent) {
+  uint32_t total = 0;
+  for(int i = 0; i < LATENCY_BUCKETS; i++) {
+    total += _buckets[i];
+  }
+  if(total == 0) {
+    return 0;
+  }
+  uint32_t threshold = (total * percent + 99) / 100;
+  uint32_t cumulated = 0;
+  for(int i = 0; i < LATENCY_BUCKETS - 1; i++) {
+    cumulated += _buckets[i];
+    if(cumulated >= threshold) {
+      uint32_t upperBound = (1UL << i) - 1;
+      return upperBound < _max ? upperBound : _max;
+    }
+  }
+  return _max;
+}
+
+int Metrics::add(const char* name) {
+  for(int i = 0; i < _count; i++) {
+    if(strcmp(_metrics[i].name, name) == 0) {
+      return i;
+    }
+  }
+  if(_count >= MAX_METRICS) {
+    Serial.printf("Too many metrics, can't add %s\n", name);
+    return -1;
+  }
+  _metrics[_count].name = name;
+  return _count++;
+}
+
+void Metrics::record(int id, uint32_t cycles) {
+  recordValue(id, cycles / ESP.getCpuFreqMHz());
+}
+
+void Metrics::recordValue(int id, uint32_t value) {
+  if(id < 0 || id >= _count) return;
+  _metrics[id].histogram.record(value);
+}
+
+/**
+ * Print all metrics, one line each: name count min avg p99 max.
+ * Durations are in microseconds, other values in their own unit (given by the metric name).
+ * Returns the printed length.
+ */
+int Metrics::print(char* buffer, int maxSize) {
+  int length = snprintf(buffer, maxSize, "# name count min avg p99 max\n");
+  for(int i = 0; i < _count && length < maxSize; i++) {
+    LatencyHistogram* histogram = &_metrics[i].histogram;
+    length += snprintf(buffer + length, maxSize - length, "%s %u %u %u %u %u\n", _metrics[i].name,
+                       histogram->getCount(), histogram->getMin(), histogram->getAvg(),
+                       histogram->getPercentile(99), histogram->getMax());
+  }
+  return length < maxSize ? length : maxSize - 1;
+}
+
+int Metrics::getCount() {
+  return _count;
+}
+#endif
@@ -0,0 +1,68 @@
+/**
+ *  Latency instrumentation of the master module loop tasks and http routes
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define METRICS_ENABLED // Comment this out to compile instrumentation out, registry included
+
+#ifdef METRICS_ENABLED
+
+#define MAX_METRICS 32
+// Bucket i counts values (durations in microseconds) needing i bits: [2^(i-1), 2^i[, last one gets the bigger ones
+#define LATENCY_BUCKETS 24
+#define METRICS_LINE_MAX_LENGTH 80
+
+class LatencyHistogram {
+public:
+  void record(uint32_t us);
+  uint32_t getCount();
+  uint32_t getMin();
+  uint32_t getAvg();
+  uint32_t getMax();
+  uint32_t getPercentile(int percent);  // upper bound of the bucket holding the percentile
+  
+protected:
+  uint32_t _count = 0;
+  uint32_t _min = 0;
+  uint32_t _max = 0;
+  uint64_t _total = 0;
+  uint16_t _buckets[LATENCY_BUCKETS] = {0};
+};
+
+typedef struct {
+  const char* name;
+  LatencyHistogram histogram;
+} metricType;
+
+class Metrics {
+public:
+  int add(const char* name);  // returns the id of the metric, existing one if same name
+  void record(int id, uint32_t cycles);
+  void recordValue(int id, uint32_t value);  // for metrics which are not durations
+  int print(char* buffer, int maxSize);
+  int getCount();
+  
+protected:
+  metricType _metrics[MAX_METRICS];
+  int _count = 0;
+};
+
+extern Metrics metrics;
+
+// Measure the duration of the enclosing scope with the cpu cycle counter
+class MetricScope {
+public:
+  MetricScope(int id) { _id = id; _start = ESP.getCycleCount(); }
+  ~MetricScope() { metrics.record(_id, ESP.getCycleCount() - _start); }
+protected:
+  int _id;
+  uint32_t _start;
+};
+#define METRIC_SCOPE(id) MetricScope _metricScope(id)
+#else
+#define METRIC_SCOPE(id)
+#endif
@@ -0,0 +1,143 @@
+/**
+ *  Execution of http requests to several agents at once, from the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "ParallelHttp.h"
+
+ParallelHttp::ParallelHttp(AgentHttpPool* httpPool) {
+  _httpPool = httpPool;
+  for(int i = 0; i < PARALLEL_HTTP_MAX; i++) {
+    _slots[i].request = NULL;
+  }
+}
+
+/**
+ * Execute the requests, PARALLEL_HTTP_MAX at a time: they are all sent, then their responses are
+ * awaited together, so a wave takes as long as its slowest agent instead of the sum of them.
+ * Each request is given timeout ms to be answered. Only the http code of the responses is read.
+ */
+void ParallelHttp::execute(parallelRequestType* requests, int count, unsigned long timeout) {
+  _httpPool->closeAll();
+  for(int start = 0; start < count; start += PARALLEL_HTTP_MAX) {
+    int waveSize = count - start;
+    if(waveSize > PARALLEL_HTTP_MAX) {
+      waveSize = PARALLEL_HTTP_MAX;
+    }
+    _executeWave(requests + start, waveSize, timeout);
+  }
+}
+
+void ParallelHttp::_executeWave(parallelRequestType* requests, int count, unsigned long timeout) {
+  int pending = 0;
+  for(int i = 0; i < count; i++) {
+    parallelRequestType* request = &requests[i];
+    if(!isValidRequest(request)) {
+      request->httpCode = 400;
+      continue;
+    }
+    if(!_httpPool->isPoolable(request->ip)) {
+      // Agent can't be reached directly
+      _executeThroughModule(request);
+      continue;
+    }
+    if(_send(&_slots[i], request, timeout)) {
+      pending ++;
+    }
+  }
+  unsigned long start = millis();
+  while(pending > 0 && millis() - start < timeout) {
+    for(int i = 0; i < count; i++) {
+      parallelSlotType* slot = &_slots[i];
+      if(slot->request != NULL && _readStatus(slot)) {
+        slot->client.stop();
+        slot->request = NULL;
+        pending --;
+      }
+    }
+    delay(1);  // lets the wifi stack receive the responses
+  }
+  for(int i = 0; i < count; i++) {
+    parallelSlotType* slot = &_slots[i];
+    if(slot->request != NULL) {
+      Serial.printf("Request to %s timed out\n", slot->request->ip);
+      slot->request->httpCode = HTTPC_ERROR_READ_TIMEOUT;
+      slot->client.stop();
+      slot->request = NULL;
+    }
+  }
+}
+
+/**
+ * Method and path come from the client and are written as is in the request line: only the usual
+ * methods are accepted, and the path must start with / and have no control character nor space,
+ * so that no header nor request can be injected.
+ */
+bool ParallelHttp::isValidRequest(parallelRequestType* request) {
+  const char* methods[] = {"GET", "POST", "PUT", "DELETE"};
+  bool validMethod = false;
+  for(unsigned int i = 0; i < sizeof(methods) / sizeof(methods[0]); i++) {
+    if(strcmp(request->method, methods[i]) == 0) {
+      validMethod = true;
+    }
+  }
+  if(!validMethod || request->path[0] != '/') return false;
+  for(const char* c = request->path; *c != 0; c++) {
+    if((uint8_t)*c <= ' ' || *c == 0x7F) return false;
+  }
+  return true;
+}
+
+// Returns false if the request could not be sent, its http code is then set.
+bool ParallelHttp::_send(parallelSlotType* slot, parallelRequestType* request, unsigned long timeout) {
+  slot->client.setTimeout(timeout);
+  if(!slot->client.connect(request->ip, 80)) {
+    Serial.printf("Connection to %s failed\n", request->ip);
+    request->httpCode = HTTPC_ERROR_CONNECTION_REFUSED;
+    return false;
+  }
+  int bodyLength = request->body == NULL ? 0 : strlen(request->body);
+  slot->client.printf("%s %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n", request->method, request->path, request->ip);
+  if(bodyLength > 0) {
+    slot->client.printf("Content-Type: application/json\r\nContent-Length: %d\r\n\r\n", bodyLength);
+    slot->client.write((const uint8_t *)request->body, bodyLength);
+  } else {
+    slot->client.print("\r\n");
+  }
+  slot->request = request;
+  slot->statusLength = 0;
+  return true;
+}
+
+// Returns true once the status line was read, or the connection was lost: the http code is then set.
+bool ParallelHttp::_readStatus(parallelSlotType* slot) {
+  while(slot->client.available() > 0 && slot->statusLength < PARALLEL_HTTP_STATUS_LENGTH) {
+    slot->status[slot->statusLength++] = slot->client.read();
+  }
+  if(slot->statusLength == PARALLEL_HTTP_STATUS_LENGTH) {
+    slot->status[slot->statusLength] = 0;
+    if(strncmp(slot->status, "HTTP/", 5) != 0) {
+      slot->request->httpCode = HTTPC_ERROR_NO_HTTP_SERVER;
+    } else {
+      slot->request->httpCode = atoi(slot->status + 9);
+    }
+    return true;
+  }
+  if(!slot->client.connected()) {
+    slot->request->httpCode = HTTPC_ERROR_CONNECTION_LOST;
+    return true;
+  }
+  return false;
+}
+
+// XIOTModule only knows about GET and POST
+void ParallelHttp::_executeThroughModule(parallelRequestType* request) {
+  if(strcmp(request->method, "GET") == 0) {
+    _httpPool->APIGet(request->ip, request->path, &request->httpCode);
+  } else if(strcmp(request->method, "POST") == 0) {
+    _httpPool->APIPost(request->ip, request->path, request->body == NULL ? "" : request->body, &request->httpCode);
+  } else {
+    request->httpCode = 501;
+  }
+}
@@ -0,0 +1,47 @@
+/**
+ *  Execution of http requests to several agents at once, from the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <ESP8266WiFi.h>
+#include "AgentHttpPool.h"
+
+// lwIP connections are shared with the web server clients and the http pool (which is emptied
+// before requests are executed): no more than this number of requests are sent at once.
+#define PARALLEL_HTTP_MAX 3
+// Time (ms) given to each request to be answered
+#define PARALLEL_HTTP_TIMEOUT 2000
+// "HTTP/1.1 200": only the status code of the responses is read
+#define PARALLEL_HTTP_STATUS_LENGTH 12
+
+typedef struct {
+  const char* ip;
+  const char* method;  // "GET", "POST", "PUT"...
+  const char* path;
+  const char* body;    // NULL if none
+  int httpCode;        // set by execute: http code of the response, or HTTPC_ERROR_* (negative)
+} parallelRequestType;
+
+typedef struct {
+  WiFiClient client;
+  parallelRequestType* request;  // NULL when slot is free
+  char status[PARALLEL_HTTP_STATUS_LENGTH + 1];
+  int statusLength;
+} parallelSlotType;
+
+class ParallelHttp {
+public:
+  ParallelHttp(AgentHttpPool* httpPool);
+  void execute(parallelRequestType* requests, int count, unsigned long timeout = PARALLEL_HTTP_TIMEOUT);
+  static bool isValidRequest(parallelRequestType* request);
+  
+protected:
+  AgentHttpPool* _httpPool;
+  parallelSlotType _slots[PARALLEL_HTTP_MAX];
+  void _executeWave(parallelRequestType* requests, int count, unsigned long timeout);
+  bool _send(parallelSlotType* slot, parallelRequestType* request, unsigned long timeout);
+  bool _readStatus(parallelSlotType* slot);
+  void _executeThroughModule(parallelRequestType* request);
+};
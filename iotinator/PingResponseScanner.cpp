@@ -0,0 +1,267 @@
+/**
+ *  Scanner for the response of an agent's /api/ping endpoint
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "PingResponseScanner.h"
+
+/**
+ * custom: storage receiving the unescaped custom string, null terminated. It's only modified
+ * when the custom key is met, and is then emptied if the value is not a string.
+ * customMaxSize: size of the storage, terminating 0 included.
+ */
+PingResponseScanner::PingResponseScanner(char* custom, int customMaxSize) {
+  _custom = custom;
+  _customMaxSize = customMaxSize;
+}
+
+size_t PingResponseScanner::write(uint8_t c) {
+  _scan((char)c);
+  return 1;
+}
+
+size_t PingResponseScanner::write(const uint8_t *data, size_t size) {
+  for(size_t i = 0; i < size; i++) {
+    _scan((char)data[i]);
+  }
+  return size;
+}
+
+void PingResponseScanner::_scan(char c) {
+  switch(_state) {
+    case EXPECT_OBJECT:
+      if(c == '{') {
+        _state = EXPECT_KEY;
+      } else if(!_isSpace(c)) {
+        _state = SCAN_ERROR;
+      }
+      break;
+      
+    case EXPECT_KEY:
+      if(c == '"') {
+        _keyLength = 0;
+        _state = IN_KEY;
+      } else if(c == '}') {
+        _state = DONE;
+      } else if(!_isSpace(c)) {
+        _state = SCAN_ERROR;
+      }
+      break;
+      
+    case IN_KEY:
+      // Keys we are interested in have no escaped characters
+      if(c == '"') {
+        _endKey();
+        _state = EXPECT_COLON;
+      } else if(_keyLength < PING_SCANNER_KEY_MAX_LENGTH) {
+        _keyName[_keyLength++] = c;
+      } else {
+        // Too long to be one of ours, but keep scanning until the end of it
+        _keyLength = PING_SCANNER_KEY_MAX_LENGTH + 1;
+      }
+      break;
+      
+    case EXPECT_COLON:
+      if(c == ':') {
+        _state = EXPECT_VALUE;
+      } else if(!_isSpace(c)) {
+        _state = SCAN_ERROR;
+      }
+      break;
+      
+    case EXPECT_VALUE:
+      if(_isSpace(c)) break;
+      if(_key == KEY_CUSTOM) {
+        _customFound = true;
+        _customSize = 0;
+        _customTooBig = false;
+        _custom[0] = 0;
+      }
+      if(c == '"') {
+        _state = IN_STRING;
+      } else if(c == '-' || (c >= '0' && c <= '9')) {
+        if(_key == KEY_HEAP) {
+          _heap = (c == '-') ? 0 : c - '0';
+        }
+        _state = IN_NUMBER;
+      } else if(c == '{' || c == '[') {
+        _nestedDepth = 1;
+        _state = IN_NESTED;
+      } else if(c >= 'a' && c <= 'z') {
+        // true, false, null: custom stays empty
+        _state = IN_LITERAL;
+      } else {
+        _state = SCAN_ERROR;
+      }
+      break;
+      
+    case IN_STRING:
+      if(c == '\\') {
+        _state = IN_ESCAPE;
+      } else if(c == '"') {
+        _state = AFTER_VALUE;
+      } else {
+        _appendCustom(c);
+      }
+      break;
+      
+    case IN_ESCAPE:
+      _state = IN_STRING;
+      switch(c) {
+        case 'b': _appendCustom('\b'); break;
+        case 'f': _appendCustom('\f'); break;
+        case 'n': _appendCustom('\n'); break;
+        case 'r': _appendCustom('\r'); break;
+        case 't': _appendCustom('\t'); break;
+        case 'u':
+          _unicode = 0;
+          _unicodeDigits = 0;
+          _state = IN_UNICODE;
+          break;
+        default:  // ", \, /
+          _appendCustom(c);
+      }
+      break;
+      
+    case IN_UNICODE:
+      _unicode <<= 4;
+      if(c >= '0' && c <= '9') {
+        _unicode |= c - '0';
+      } else if(c >= 'a' && c <= 'f') {
+        _unicode |= c - 'a' + 10;
+      } else if(c >= 'A' && c <= 'F') {
+        _unicode |= c - 'A' + 10;
+      } else {
+        _state = SCAN_ERROR;
+        break;
+      }
+      if(++_unicodeDigits == 4) {
+        _appendUnicode(_unicode);
+        _state = IN_STRING;
+      }
+      break;
+      
+    case IN_NUMBER:
+      if(c >= '0' && c <= '9') {
+        if(_key == KEY_HEAP) {
+          _heap = _heap * 10 + (c - '0');
+        }
+      } else if(c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-') {
+        // Not expected for heap, but valid json: just skip it
+      } else {
+        _state = AFTER_VALUE;
+        _scan(c);
+      }
+      break;
+      
+    case IN_LITERAL:
+      if(c < 'a' || c > 'z') {
+        _state = AFTER_VALUE;
+        _scan(c);
+      }
+      break;
+      
+    case IN_NESTED:
+      if(c == '"') {
+        _state = IN_NESTED_STRING;
+      } else if(c == '{' || c == '[') {
+        _nestedDepth ++;
+      } else if(c == '}' || c == ']') {
+        if(--_nestedDepth == 0) {
+          _state = AFTER_VALUE;
+        }
+      }
+      break;
+      
+    case IN_NESTED_STRING:
+      if(c == '\\') {
+        _state = IN_NESTED_ESCAPE;
+      } else if(c == '"') {
+        _state = IN_NESTED;
+      }
+      break;
+      
+    case IN_NESTED_ESCAPE:
+      _state = IN_NESTED_STRING;
+      break;
+      
+    case AFTER_VALUE:
+      if(c == ',') {
+        _state = EXPECT_KEY;
+      } else if(c == '}') {
+        _state = DONE;
+      } else if(!_isSpace(c)) {
+        _state = SCAN_ERROR;
+      }
+      break;
+      
+    case DONE:
+      if(!_isSpace(c)) {
+        _state = SCAN_ERROR;
+      }
+      break;
+      
+    case SCAN_ERROR:
+      break;
+  }
+}
+
+void PingResponseScanner::_endKey() {
+  _key = KEY_OTHER;
+  if(_keyLength > PING_SCANNER_KEY_MAX_LENGTH) return;
+  _keyName[_keyLength] = 0;
+  if(strcmp(_keyName, XIOTModuleJsonTag::heap) == 0) {
+    _key = KEY_HEAP;
+  } else if(strcmp(_keyName, XIOTModuleJsonTag::custom) == 0) {
+    _key = KEY_CUSTOM;
+  }
+}
+
+void PingResponseScanner::_appendCustom(char c) {
+  if(_key != KEY_CUSTOM) return;
+  if(_customSize >= _customMaxSize - 1) {
+    _customTooBig = true;
+    return;
+  }
+  _custom[_customSize++] = c;
+  _custom[_customSize] = 0;
+}
+
+// Encode a \uXXXX escaped character to utf-8
+void PingResponseScanner::_appendUnicode(uint32_t codePoint) {
+  if(codePoint < 0x80) {
+    _appendCustom(codePoint);
+  } else if(codePoint < 0x800) {
+    _appendCustom(0xC0 | (codePoint >> 6));
+    _appendCustom(0x80 | (codePoint & 0x3F));
+  } else {
+    _appendCustom(0xE0 | (codePoint >> 12));
+    _appendCustom(0x80 | ((codePoint >> 6) & 0x3F));
+    _appendCustom(0x80 | (codePoint & 0x3F));
+  }
+}
+
+bool PingResponseScanner::_isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bool PingResponseScanner::isComplete() {
+  return _state == DONE;
+}
+
+uint32_t PingResponseScanner::getHeap() {
+  return _heap;
+}
+
+int PingResponseScanner::getCustomSize() {
+  return _customSize;
+}
+
+bool PingResponseScanner::isCustomFound() {
+  return _customFound;
+}
+
+bool PingResponseScanner::isCustomTooBig() {
+  return _customTooBig;
+}
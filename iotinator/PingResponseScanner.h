@@ -0,0 +1,62 @@
+/**
+ *  Scanner for the response of an agent's /api/ping endpoint
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <XIOTModule.h>
+
+// Longest key we need to recognize is "custom"; longer keys are just skipped
+#define PING_SCANNER_KEY_MAX_LENGTH 10
+
+/**
+ * The ping response is a flat json object, like {"heap":21560,"custom":"{\"on\":true}"}.
+ * It is fed byte by byte as the response body is read from the connection: the heap value is
+ * decoded on the fly and the custom string is unescaped directly into the caller's storage,
+ * so that no intermediate buffer nor allocation is needed.
+ * Unknown keys are skipped, whatever the type of their value.
+ */
+class PingResponseScanner:public Stream {
+public:
+  PingResponseScanner(char* custom, int customMaxSize);
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *data, size_t size) override;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  void flush() override {}
+  
+  bool isComplete();  // true when the whole object was scanned without error
+  uint32_t getHeap();
+  int getCustomSize();
+  bool isCustomFound();
+  bool isCustomTooBig();
+  
+protected:
+  enum ScannerState {EXPECT_OBJECT, EXPECT_KEY, IN_KEY, EXPECT_COLON, EXPECT_VALUE, IN_STRING, IN_ESCAPE,
+                     IN_UNICODE, IN_NUMBER, IN_LITERAL, IN_NESTED, IN_NESTED_STRING, IN_NESTED_ESCAPE,
+                     AFTER_VALUE, DONE, SCAN_ERROR};
+  enum ScannerKey {KEY_OTHER, KEY_HEAP, KEY_CUSTOM};
+  
+  ScannerState _state = EXPECT_OBJECT;
+  ScannerKey _key = KEY_OTHER;
+  char _keyName[PING_SCANNER_KEY_MAX_LENGTH + 1];
+  int _keyLength = 0;
+  char* _custom;
+  int _customMaxSize;
+  int _customSize = 0;
+  bool _customFound = false;
+  bool _customTooBig = false;
+  uint32_t _heap = 0;
+  uint32_t _unicode = 0;
+  int _unicodeDigits = 0;
+  int _nestedDepth = 0;
+  
+  void _scan(char c);
+  void _endKey();
+  void _appendCustom(char c);
+  void _appendUnicode(uint32_t codePoint);
+  static bool _isSpace(char c);
+};
@@ -0,0 +1,100 @@
+/**
+ *  Spreading of the agent registrations to the iotinator master when they all come at once
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "RegistrationPacer.h"
+
+RegistrationPacer::RegistrationPacer() {
+  for(int i = 0; i < REGISTRATION_MAX_SLOTS; i++) {
+    _slots[i].ip = 0;
+  }
+}
+
+/**
+ * Check if a registration from the agent at the given ip can be processed now.
+ * If so, returns 0. Otherwise the agent is given a slot, and the time (ms) after which it should
+ * come back is returned: during a storm, or before notBefore (millis() time).
+ * Agents coming back at their slot are let through, new ones wait for the agents already given a slot.
+ */
+unsigned long RegistrationPacer::admit(uint32_t ip, unsigned long notBefore) {
+  unsigned long now = millis();
+  _expire(now);
+  registrationSlotType* slot = _find(ip);
+  if(slot != NULL) {
+    if((long)(now - slot->time) >= 0) {
+      slot->ip = 0;
+      _reservedCount --;
+      return 0;
+    }
+    // Came back too early
+    return slot->time - now;
+  }
+  if(now - _windowStart >= REGISTRATION_STORM_WINDOW) {
+    _windowStart = now;
+    _windowCount = 0;
+  }
+  _windowCount ++;
+  bool storm = _windowCount > REGISTRATION_STORM_THRESHOLD || _reservedCount > 0;
+  if(!storm && (long)(now - notBefore) >= 0) {
+    return 0;
+  }
+  // Next slot after the last assigned one
+  unsigned long time = now + REGISTRATION_SLOT_SPACING;
+  if(_reservedCount > 0 && (long)(_lastSlotTime + REGISTRATION_SLOT_SPACING - time) > 0) {
+    time = _lastSlotTime + REGISTRATION_SLOT_SPACING;
+  }
+  if((long)(notBefore - time) > 0) {
+    time = notBefore;
+  }
+  registrationSlotType* freeSlot = _find(REGISTRATION_FREE_SLOT);
+  if(freeSlot == NULL) {
+    // No slot left: the agent comes back after the assigned ones, at a time of its own, and is then
+    // handled as a new one. The schedule is not extended for it.
+    time += _spread(ip);
+  }
+  // Agents deferred for the longest come back spread, not all at once
+  if(time - now > REGISTRATION_MAX_DELAY) {
+    time = now + REGISTRATION_MAX_DELAY - _spread(ip);
+  }
+  _deferredCount ++;
+  if(freeSlot != NULL) {
+    freeSlot->ip = ip;
+    freeSlot->time = time;
+    _reservedCount ++;
+    _lastSlotTime = time;
+  }
+  return time - now;
+}
+
+// Slot of the given ip, or a free slot for REGISTRATION_FREE_SLOT
+registrationSlotType* RegistrationPacer::_find(uint32_t ip) {
+  if(ip == 0) return NULL;
+  if(ip == REGISTRATION_FREE_SLOT) ip = 0;
+  for(int i = 0; i < REGISTRATION_MAX_SLOTS; i++) {
+    if(_slots[i].ip == ip) {
+      return &_slots[i];
+    }
+  }
+  return NULL;
+}
+
+// Delay specific to an agent, so that the agents without a slot don't come back together
+unsigned long RegistrationPacer::_spread(uint32_t ip) {
+  return (ip * 2654435761UL) % REGISTRATION_SPREAD_WINDOW;
+}
+
+// Free the slots of the agents that did not come back
+void RegistrationPacer::_expire(unsigned long now) {
+  for(int i = 0; i < REGISTRATION_MAX_SLOTS; i++) {
+    if(_slots[i].ip != 0 && (long)(now - _slots[i].time) > REGISTRATION_SLOT_GRACE) {
+      _slots[i].ip = 0;
+      _reservedCount --;
+    }
+  }
+}
+
+unsigned long RegistrationPacer::getDeferredCount() {
+  return _deferredCount;
+}
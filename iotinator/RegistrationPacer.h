@@ -0,0 +1,51 @@
+/**
+ *  Spreading of the agent registrations to the iotinator master when they all come at once
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define JSON_TAG_RETRY_AFTER "retryAfter"
+
+// More registrations than this within the window is a storm: registrations are then given slots
+#define REGISTRATION_STORM_WINDOW 1000  // ms
+#define REGISTRATION_STORM_THRESHOLD 3
+// Time between two assigned slots, about what a registration takes to be processed
+#define REGISTRATION_SLOT_SPACING 300  // ms
+// A slot is forgotten if its agent did not come back within this time after it
+#define REGISTRATION_SLOT_GRACE 5000  // ms
+// Registrations are never deferred longer than this
+#define REGISTRATION_MAX_DELAY 60000  // ms
+#define REGISTRATION_MAX_SLOTS 16
+// Agents without a slot come back within this window, at about the rate the slots are given
+#define REGISTRATION_SPREAD_WINDOW 20000  // ms
+// Broadcast address, never the one of an agent: used to look for a free slot
+#define REGISTRATION_FREE_SLOT 0xFFFFFFFF
+// Agents registering on the default Access Point need to register again once the master
+// switched to the custom one: they are rather given a slot after the switch
+#define REGISTRATION_AP_SWITCH_DELAY 3000  // ms
+
+typedef struct {
+  uint32_t ip;  // 0 when slot is free
+  unsigned long time;
+} registrationSlotType;
+
+class RegistrationPacer {
+public:
+  RegistrationPacer();
+  unsigned long admit(uint32_t ip, unsigned long notBefore = 0);
+  unsigned long getDeferredCount();
+  
+protected:
+  registrationSlotType _slots[REGISTRATION_MAX_SLOTS];
+  unsigned long _lastSlotTime = 0;
+  unsigned long _windowStart = 0;
+  int _windowCount = 0;
+  int _reservedCount = 0;
+  unsigned long _deferredCount = 0;
+  registrationSlotType* _find(uint32_t ip);
+  unsigned long _spread(uint32_t ip);
+  void _expire(unsigned long now);
+};
@@ -0,0 +1,33 @@
+/**
+ *  Writable copy of the body of the request being served, for handlers parsing it in place
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "RequestBody.h"
+
+RequestBody::RequestBody(const String& body) {
+  unsigned int size = body.length() + 1;
+  if(size > REQUEST_BODY_MAX_SIZE) {
+    _tooBig = true;
+    return;
+  }
+  _body = size <= REQUEST_BODY_STACK_SIZE ? _stackBuffer : (char *)malloc(size);
+  if(_body != NULL) {
+    memcpy(_body, body.c_str(), size);
+  }
+}
+
+RequestBody::~RequestBody() {
+  if(_body != _stackBuffer) {
+    free(_body);
+  }
+}
+
+char* RequestBody::get() {
+  return _body;
+}
+
+bool RequestBody::isTooBig() {
+  return _tooBig;
+}
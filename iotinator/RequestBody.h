@@ -0,0 +1,31 @@
+/**
+ *  Writable copy of the body of the request being served, for handlers parsing it in place
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// Bodies up to this size (terminating 0 included) are copied on the stack, bigger ones on the heap
+#define REQUEST_BODY_STACK_SIZE 256
+// Bigger bodies are rejected
+#define REQUEST_BODY_MAX_SIZE 2048
+
+/**
+ * The json parser writes to the body it parses (unescaped strings, terminating zeros) and the
+ * parsed values point into it: it needs a copy, since the web server's one must stay untouched
+ * for the handlers forwarding it. The copy lives as long as this object, in the handler's scope.
+ */
+class RequestBody {
+public:
+  RequestBody(const String& body);
+  ~RequestBody();
+  char* get();       // NULL if the body could not be copied
+  bool isTooBig();   // the body could not be copied because of its size, rather than a lack of memory
+  
+protected:
+  char _stackBuffer[REQUEST_BODY_STACK_SIZE];
+  char* _body = NULL;
+  bool _tooBig = false;
+};
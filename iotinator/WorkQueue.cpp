@@ -0,0 +1,143 @@
+/**
+ *  Queue of the work deferred out of request handlers in the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "WorkQueue.h"
+#include "AgentCollection.h"
+
+WorkQueue::WorkQueue(AgentCollection* agentCollection) {
+  _agentCollection = agentCollection;
+  for(int i = 0; i < WORK_QUEUE_SIZE; i++) {
+    _items[i].used = false;
+  }
+}
+
+/**
+ * Queue some work on an agent, to be done at least delay ms from now.
+ * If the same work is already queued for that agent, it's only done once, with the new delay.
+ * Returns false if the queue is full.
+ */
+bool WorkQueue::push(WorkType type, const char* mac, unsigned long delay) {
+  return _push(type, mac, NULL, delay);
+}
+
+bool WorkQueue::push(void (*callback)(), unsigned long delay) {
+  return _push(WORK_CALLBACK, "", callback, delay);
+}
+
+bool WorkQueue::_push(WorkType type, const char* mac, void (*callback)(), unsigned long delay) {
+  unsigned long notBefore = millis() + delay;
+  workItemType* item = _find(type, mac, callback);
+  if(item != NULL) {
+    item->notBefore = notBefore;
+    _coalescedCount ++;
+    return true;
+  }
+  for(int i = 0; i < WORK_QUEUE_SIZE; i++) {
+    if(!_items[i].used) {
+      item = &_items[i];
+      break;
+    }
+  }
+  if(item == NULL) {
+    _droppedCount ++;
+    Serial.printf("Work queue full, dropping work %d for '%s'\n", type, mac);
+    return false;
+  }
+  item->type = type;
+  XUtils::safeStringCopy(item->mac, mac, MAC_ADDR_MAX_LENGTH);
+  item->callback = callback;
+  item->notBefore = notBefore;
+  item->sequence = _sequence++;
+  item->used = true;
+  return true;
+}
+
+void WorkQueue::cancel(WorkType type, const char* mac) {
+  workItemType* item = _find(type, mac, NULL);
+  if(item != NULL) {
+    item->used = false;
+  }
+}
+
+workItemType* WorkQueue::_find(WorkType type, const char* mac, void (*callback)()) {
+  for(int i = 0; i < WORK_QUEUE_SIZE; i++) {
+    workItemType* item = &_items[i];
+    if(item->used && item->type == type && item->callback == callback && strcmp(item->mac, mac) == 0) {
+      return item;
+    }
+  }
+  return NULL;
+}
+
+// Oldest item which is due, if any
+workItemType* WorkQueue::_next(unsigned long now) {
+  workItemType* next = NULL;
+  for(int i = 0; i < WORK_QUEUE_SIZE; i++) {
+    workItemType* item = &_items[i];
+    if(!item->used || (long)(now - item->notBefore) < 0) continue;
+    if(next == NULL || item->sequence < next->sequence) {
+      next = item;
+    }
+  }
+  return next;
+}
+
+/**
+ * Process due items until the budget is spent. One item is always processed if any is due:
+ * the budget can only be checked between items.
+ * Returns the number of processed items.
+ */
+int WorkQueue::drain(unsigned long budget) {
+  unsigned long start = millis();
+  int count = 0;
+  workItemType* item;
+  while((count == 0 || millis() - start < budget) && (item = _next(millis())) != NULL) {
+    // Free the slot first: the work may push new items
+    workItemType work = *item;
+    item->used = false;
+    _execute(&work);
+    count ++;
+  }
+  return count;
+}
+
+void WorkQueue::_execute(workItemType* item) {
+  if(item->type == WORK_CALLBACK) {
+    item->callback();
+    return;
+  }
+  // Agent is looked up at execution time, in case it changed since the work was queued
+  Agent* agent = _agentCollection->getByMac(item->mac);
+  if(agent == NULL) return;
+  switch(item->type) {
+    case WORK_RENAME:
+      if(agent->getToRename()) {
+        _agentCollection->autoRename(agent);
+      }
+      break;
+    case WORK_VERIFY:
+      _agentCollection->verify(agent);
+      break;
+    default:
+      break;
+  }
+}
+
+int WorkQueue::getCount() {
+  int count = 0;
+  for(int i = 0; i < WORK_QUEUE_SIZE; i++) {
+    if(_items[i].used) count ++;
+  }
+  return count;
+}
+
+unsigned long WorkQueue::getCoalescedCount() {
+  return _coalescedCount;
+}
+
+unsigned long WorkQueue::getDroppedCount() {
+  return _droppedCount;
+}
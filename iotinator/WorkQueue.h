@@ -0,0 +1,48 @@
+/**
+ *  Queue of the work deferred out of request handlers in the iotinator master
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <XIOTModule.h>
+
+class AgentCollection;
+
+#define WORK_QUEUE_SIZE 16
+// Time (ms) after which no more work item is started in one loop iteration
+#define WORK_QUEUE_BUDGET 200
+
+enum WorkType {WORK_RENAME, WORK_VERIFY, WORK_CALLBACK};
+
+typedef struct {
+  WorkType type;
+  char mac[MAC_ADDR_MAX_LENGTH + 1];  // agent the work applies to, empty for callbacks
+  void (*callback)();
+  unsigned long notBefore;
+  unsigned long sequence;  // items are processed in the order they were pushed
+  bool used;
+} workItemType;
+
+class WorkQueue {
+public:
+  WorkQueue(AgentCollection* agentCollection);
+  bool push(WorkType type, const char* mac, unsigned long delay = 0);
+  bool push(void (*callback)(), unsigned long delay = 0);
+  void cancel(WorkType type, const char* mac);
+  int drain(unsigned long budget = WORK_QUEUE_BUDGET);
+  int getCount();
+  unsigned long getCoalescedCount();
+  unsigned long getDroppedCount();
+  
+protected:
+  AgentCollection* _agentCollection;
+  workItemType _items[WORK_QUEUE_SIZE];
+  unsigned long _sequence = 0;
+  unsigned long _coalescedCount = 0;
+  unsigned long _droppedCount = 0;
+  bool _push(WorkType type, const char* mac, void (*callback)(), unsigned long delay);
+  workItemType* _find(WorkType type, const char* mac, void (*callback)());
+  workItemType* _next(unsigned long now);
+  void _execute(workItemType* item);
+};
@@ -14,6 +14,14 @@
 
 #include "masterConfig.h"
 #include "AgentCollection.h"
+#include "Heartbeat.h"
+#include "LoopScheduler.h"
+#include "Metrics.h"
+#include "ForwardCache.h"
+#include "AdmissionControl.h"
+#include "RegistrationPacer.h"
+#include "FallThroughHandler.h"
+#include "RequestBody.h"
 
 #include "initPageHtml.h"
 #include "appLoader.h"
@@ -23,6 +31,16 @@
 
 #define API_VERSION "1.0"    // modules can check API version to make sure they are compatible...
 
+#define LOOP_MAX_SLEEP 1000    // ms, actual sleep is bounded by the next task deadline
+#define DISPLAY_REFRESH_PERIOD 50    // ms
+// Maximum number of agent commands in one /api/batch request
+#define BATCH_MAX_COMMANDS 10
+#define BATCH_JSON_BUFFER_SIZE (JSON_ARRAY_SIZE(BATCH_MAX_COMMANDS) + BATCH_MAX_COMMANDS * JSON_OBJECT_SIZE(6))
+// Period at which the config journal is checked, to be compacted before it is full
+#define CONFIG_JOURNAL_CHECK_PERIOD 10000    // ms
+// Period at which a requested config save is checked, see MasterConfigClass::flush
+#define CONFIG_SAVE_CHECK_PERIOD 500    // ms
+
 // Global object to store config
 MasterConfigClass *config;
 DisplayClass *oledDisplay;
@@ -37,23 +55,39 @@ GsmClass gsm(&serialSIM800);
 #include "gsmMessageHandlers.h"
 
 ESP8266WebServer* server;
+AdmissionControl* admission;
+RegistrationPacer registrationPacer;
+#ifdef METRICS_ENABLED
+uint32_t requestStartHeap = 0;
+int requestHeapMetricId = -1;
+#endif
 bool homeWifiConnected = false;
 bool homeWifiFirstConnected = false;
 NTPSyncEvent_t ntpEvent;
 bool ntpEventToProcess = false;
 bool ntpServerInitialized = false;
 bool ntpTimeInitialized = false;
-unsigned long elapsed200ms = 0;
-unsigned long elapsed500ms = 0;
-unsigned long elapsed2s = 0;
 bool gsmEnabled = false;
 MDNSResponder mdns;
-time_t timeNow = 0; 
-time_t timeLastTimeDisplay = 0;
-time_t timeLastWifiDisplay = 0;
-time_t timeLastPing = 0;
+LoopScheduler scheduler;
+ForwardCache forwardCache;
+// The /api/config response only changes with the config, wifi, NTP or GSM state, but for its timestamp:
+// it's rendered once without the closing brace, and the timestamp is appended for each request.
+char configResponse[JSON_STRING_CONFIG_SIZE + 30];
+int configResponsePrefixLength = 0;  // 0 when it needs to be rendered again
 AgentCollection *agentCollection;
-Agent* agentToRename = NULL;
+Heartbeat *heartbeat;
+
+// Station events on the Access Point are received in the wifi event handlers, and
+// processed in the loop, where the agent collection can be safely updated.
+#define MAX_STATION_EVENTS 8
+typedef struct {
+  uint8_t mac[6];
+  bool connected;
+} stationEventType;
+stationEventType stationEvents[MAX_STATION_EVENTS];
+volatile uint8_t stationEventsHead = 0;
+volatile uint8_t stationEventsTail = 0;
 
 char glaCss1[50];
 char glaCss2[50];
@@ -115,6 +149,13 @@ void setup() {
   WiFi.mode(WIFI_AP);
   initSoftAP();
   
+  // Agents advertised with the heartbeat port in /api/config can send UDP heartbeats
+  // instead of being pinged over HTTP
+  heartbeat = new Heartbeat([](const uint8_t* mac, uint32_t heap, const char* custom, int customSize) {
+    return agentCollection->heartbeat(mac, heap, custom, customSize) != NULL;
+  });
+  heartbeat->begin();
+  
   // If Home wifi was configured previously, module should connect to Home Wifi.
   if(config->isHomeWifiConfigured()) {
     Serial.print(MSG_WIFI_CONNECTING_HOME);
@@ -128,6 +169,7 @@ void setup() {
   
   initGsmMessageHandlers();
   gsmEnabled = gsm.init();
+  invalidateConfigResponse();
   printNumbers();     
   
   wifiSTAGotIpHandler = WiFi.onStationModeGotIP(onSTAGotIP); 
@@ -137,7 +179,8 @@ void setup() {
     ntpEventToProcess = true;
     ntpEvent = event;
   });
-     
+  
+  initTasks();
 }
 
 // Opens the Wifi network Access Point.
@@ -155,13 +198,39 @@ void onStationConnected(const WiFiEventSoftAPModeStationConnected& evt) {
   sprintf(message, "Mac %02x:%02x:%02x:%02x:%02x:%02x\n", evt.mac[0], evt.mac[1], evt.mac[2], evt.mac[3], evt.mac[4], evt.mac[5]);
   oledDisplay->setLine(1, MSG_WIFI_STATION_CONNECTED, TRANSIENT, NOT_BLINKING);
   oledDisplay->setLine(2, message, TRANSIENT, NOT_BLINKING);  
+  pushStationEvent(evt.mac, true);
 }
 
 void onStationDisconnected(const WiFiEventSoftAPModeStationDisconnected& evt) {
   oledDisplay->setLine(1, MSG_WIFI_STATION_DISCONNECTED, TRANSIENT, NOT_BLINKING);
-  // TODO: remove it from agent collection ?
-  // Disconnection needs a long time to be triggered (15mn ?)
-  // May be periodic ping should be enough ?
+  // Agent is not removed from the collection, just flagged as disconnected: it will be
+  // flagged back as connected as soon as it reconnects and answers a ping.
+  pushStationEvent(evt.mac, false);
+}
+
+// Store a station event to be processed in the loop. When the queue is full, event is dropped:
+// periodic ping will eventually catch up.
+void pushStationEvent(const uint8_t* mac, bool connected) {
+  uint8_t next = (stationEventsHead + 1) % MAX_STATION_EVENTS;
+  if(next == stationEventsTail) {
+    Serial.println("Station event dropped");
+    return;
+  }
+  memcpy(stationEvents[stationEventsHead].mac, mac, 6);
+  stationEvents[stationEventsHead].connected = connected;
+  stationEventsHead = next;
+}
+
+void processStationEvents() {
+  while(stationEventsTail != stationEventsHead) {
+    stationEventType* event = &stationEvents[stationEventsTail];
+    if(event->connected) {
+      agentCollection->stationConnected(event->mac);
+    } else {
+      agentCollection->stationDisconnected(event->mac);
+    }
+    stationEventsTail = (stationEventsTail + 1) % MAX_STATION_EVENTS;
+  }
 }
 
 // Called when STA is connected to home wifi and IP was obtained
@@ -169,6 +238,7 @@ void onSTAGotIP (WiFiEventStationModeGotIP ipInfo) {
   ipOnHomeSsid = ipInfo.ip.toString();
   Serial.printf("Got IP on %s: %s\n", config->getHomeSsid(), ipOnHomeSsid.c_str());
   homeWifiConnected = true;
+  invalidateConfigResponse();
   if(module->isWaitingOTA()) {
     char message[40];
     sprintf(message, "Ota master ready: %s", ipOnHomeSsid.c_str());
@@ -203,6 +273,7 @@ void processNtpEvent() {
     Serial.print("Got NTP time: ");
     Serial.println(NTP.getTimeDateString(NTP.getLastNTPSync()));
     ntpTimeInitialized = true;
+    invalidateConfigResponse();
     timeDisplay();
     NTP.setInterval(7200, 7200);  // 5h retry, 2h refresh. once we have time, refresh failure is not critical
   }
@@ -212,6 +283,7 @@ void onSTADisconnected(WiFiEventStationModeDisconnected event) {
   if(homeWifiConnected) {
     Serial.printf("Lost connection to %s, error: %d\n", event.ssid.c_str(), event.reason);
     homeWifiConnected = false;
+    invalidateConfigResponse();
     wifiDisplay();
     NTP.stop();
   }
@@ -219,7 +291,11 @@ void onSTADisconnected(WiFiEventStationModeDisconnected event) {
 
 void addEndpoints() {
   server = module->getServer();  
-  server->on("/", HTTP_GET, [](){
+  admission = new AdmissionControl(module);
+#ifdef METRICS_ENABLED
+  requestHeapMetricId = metrics.add("request.heap_bytes");
+#endif
+  addRoute("/", HTTP_GET, [](){
     if (config->isAPInitialized()) {
       if(server->arg("app") == "gla") {
         printAppGLAPage();
@@ -231,29 +307,37 @@ void addEndpoints() {
     }
   });
 
-  server->on("/init", HTTP_GET, [](){
+  addRoute("/init", HTTP_GET, [](){
     printHomePage();
   });
 
-  server->on("/api/list", HTTP_GET, [](){
+  addRoute("/api/list", HTTP_GET, [](){
     int size = agentCollection->getCount();
-    int customStrSize = 0;
     
     // Size estimation: https://arduinojson.org/assistant/
     // TODO: update this when necessary : 10 fields per agent (for now it's actually 8)
     const size_t bufferSize = size*JSON_OBJECT_SIZE(10)
                               + JSON_OBJECT_SIZE(size)
-                              +  + JSON_OBJECT_SIZE(1) ;
+                              + JSON_OBJECT_SIZE(2) ;
     
     DynamicJsonBuffer jsonBuffer(bufferSize);
     JsonObject& root = jsonBuffer.createObject();    
-    JsonObject& agentList = root.createNestedObject("agentList");
-    
-    agentCollection->list(agentList, &customStrSize);
- 
-    char* strBuffer = (char *)malloc(customStrSize); 
-    root.printTo(strBuffer, customStrSize-1);
-    Serial.printf("Reserved size: %d, actual size: %d\n", customStrSize, strlen(strBuffer));
+    agentCollection->list(root);
+    // Exact length is known without measuring the json. One more byte than needed is allocated so
+    // that a longer json is detected: it's then measured, never sent truncated.
+    int length = agentCollection->getListSize();
+    char* strBuffer = (char *)malloc(length + 2); 
+    if(strBuffer != NULL && (int)root.printTo(strBuffer, length + 2) != length) {
+      int actualLength = root.measureLength();
+      Serial.printf("List size mismatch: expected %d, actual %d\n", length, actualLength);
+      free(strBuffer);
+      strBuffer = (char *)malloc(actualLength + 1);
+      if(strBuffer != NULL) root.printTo(strBuffer, actualLength + 1);
+    }
+    if(strBuffer == NULL) {
+      module->sendJson("{\"error\": \"Not enough memory.\"}", 503);
+      return;
+    }
     module->sendJson(strBuffer, 200);
     free(strBuffer); 
 
@@ -261,33 +345,83 @@ void addEndpoints() {
     Serial.printf("%s After /api/list Free heap mem: %d\n", NTP.getTimeDateString().c_str(), freeMem);   
   });
   
+  // Ping round trip times and availability of the agents, to spot the flaky ones.
+  // Optional mac argument to get only one agent.
+  addRoute("/api/agentStats", HTTP_GET, [](){
+    const char* mac = NULL;
+    int size = agentCollection->getCount();
+    String macArg = server->arg("mac");
+    if(macArg.length() > 0) {
+      mac = macArg.c_str();
+      size = 1;
+    }
+    DynamicJsonBuffer jsonBuffer(size*JSON_AGENT_STATS_SIZE + JSON_OBJECT_SIZE(size));
+    JsonObject& root = jsonBuffer.createObject();
+    if(!agentCollection->stats(root, mac)) {
+      module->sendJson("{\"error\": \"Agent not found.\"}", 404);
+      return;
+    }
+    int length = root.measureLength() + 1;
+    char* strBuffer = (char *)malloc(length); 
+    root.printTo(strBuffer, length);
+    module->sendJson(strBuffer, 200);
+    free(strBuffer); 
+  });
+  
+  // Latency of each loop task and route, in a compact text format
+  addRoute("/api/metrics", HTTP_GET, [](){
+#ifdef METRICS_ENABLED
+    int size = (metrics.getCount() + 1) * METRICS_LINE_MAX_LENGTH + 400;
+    char* strBuffer = (char *)malloc(size);
+    int length = metrics.print(strBuffer, size);
+    WorkQueue* workQueue = agentCollection->getWorkQueue();
+    snprintf(strBuffer + length, size - length, 
+             "heartbeat.received %lu\nheartbeat.rejected %lu\nhttpPool.requests %lu\nhttpPool.reused %lu\n"
+             "workQueue.pending %d\nworkQueue.coalesced %lu\nworkQueue.dropped %lu\n"
+             "forwardCache.hits %lu\nforwardCache.misses %lu\n"
+             "admission.rejectedHeap %lu\nadmission.rejectedClient %lu\nadmission.rejectedRoute %lu\n"
+             "registration.deferred %lu\n"
+             "config.flashWrites %lu\nconfig.flashWritesPerDay %lu\n",
+             heartbeat->getReceivedCount(), heartbeat->getRejectedCount(),
+             agentCollection->getHttpPool()->getRequestCount(), agentCollection->getHttpPool()->getReuseCount(),
+             workQueue->getCount(), workQueue->getCoalescedCount(), workQueue->getDroppedCount(),
+             forwardCache.getHitCount(), forwardCache.getMissCount(),
+             admission->getHeapRejectedCount(), admission->getClientRejectedCount(), admission->getRouteRejectedCount(),
+             registrationPacer.getDeferredCount(),
+             config->getFlashWriteCount(), config->getFlashWritesPerDay());
+    module->sendText(strBuffer, 200);
+    free(strBuffer);
+#else
+    module->sendText("Metrics disabled", 404);
+#endif
+  });
+  
   // TODO: remove duplicated code with XIOTModule !!
-  server->on("/api/rename", HTTP_POST, [&]() {
-    char *forwardTo;
-    XUtils::stringToCharP(server->header("Xiot-forward-to"), &forwardTo);
-    String jsonBody = server->arg("plain");
+  addRoute("/api/rename", HTTP_POST, [&]() {
+    const String& forwardTo = server->header("Xiot-forward-to");
     char message[100];
     
     // I've seen a few unexplained parsing error so I have set a bigger buffer size...
+    // Copy of the body is parsed in place (strings are not duplicated into the json buffer)
+    RequestBody body(server->arg("plain"));
+    if(!checkRequestBody(&body)) return;
     const int bufferSize = 2* JSON_OBJECT_SIZE(2);
     StaticJsonBuffer<bufferSize> jsonBuffer; 
-    JsonObject& root = jsonBuffer.parseObject(jsonBody); 
+    JsonObject& root = jsonBuffer.parseObject(body.get()); 
+    recordRequestHeap();
     if (!root.success()) {
       module->sendJson("{}", 500);
-      if(strlen(forwardTo) != 0) { 
+      if(forwardTo.length() != 0) { 
         oledDisplay->setLine(1, "Renaming agent failed", TRANSIENT, NOT_BLINKING);
       } else {
         oledDisplay->setLine(1, "Renaming master failed", TRANSIENT, NOT_BLINKING);
       }
-      free(forwardTo);
       return;
     }
     // Forward the rename to an agent
-    if(strlen(forwardTo) != 0) {     
-      agentCollection->renameAgent(forwardTo, (const char*)root["name"]);
-      free(forwardTo);
+    if(forwardTo.length() != 0) {     
+      agentCollection->renameAgent(forwardTo.c_str(), (const char*)root["name"]);
     } else {
-      free(forwardTo);    
       if(config == NULL) {
         module->sendJson("{\"error\": \"No config to update.\"}", 404);
         return;
@@ -295,7 +429,7 @@ void addEndpoints() {
       sprintf(message, "Renaming master to %s\n", (const char*)root["name"] ); 
       oledDisplay->setLine(1, message, TRANSIENT, NOT_BLINKING);
       config->setName((const char*)root["name"]);
-      config->saveToEeprom(); // TODO: partial save !!   
+      config->requestSave(); // only the name is written
       oledDisplay->setTitle(config->getName());
     }    
     module->sendJson("{}", 200);   // HTTP code 200 is enough
@@ -306,44 +440,47 @@ void addEndpoints() {
    * => may be agent modules could also create an access point and act as relay for
    * other modules.
    **/
-  server->on("/api/config", HTTP_GET, [](){
+  addRoute("/api/config", HTTP_GET, [](){
 //    Serial.println("Rq on /api/config");
-    char configMsg[JSON_STRING_CONFIG_SIZE];
-    StaticJsonBuffer<JSON_BUFFER_CONFIG_SIZE> jsonBuffer;    
-    // Create the root object
-    JsonObject& root = jsonBuffer.createObject();
-    root[XIOTModuleJsonTag::version] = API_VERSION ;
-    root[XIOTModuleJsonTag::APInitialized] = config->isAPInitialized();
-    root[XIOTModuleJsonTag::APSsid] = config->getApSsid(true);
-    root[XIOTModuleJsonTag::APPwd] = config->getApPwd(true);
-    root[XIOTModuleJsonTag::timestamp] = now();
-    root[XIOTModuleJsonTag::homeWifiConnected] = homeWifiConnected;
-    root[XIOTModuleJsonTag::gsmEnabled] = gsmEnabled;
-    root[XIOTModuleJsonTag::timeInitialized] = ntpTimeInitialized;
-    root.printTo(configMsg, JSON_STRING_CONFIG_SIZE);
-    module->sendJson(configMsg, 200);
+    if(configResponsePrefixLength == 0) {
+      renderConfigResponse();
+    }
+    snprintf(configResponse + configResponsePrefixLength, sizeof(configResponse) - configResponsePrefixLength,
+             ",\"%s\":%lu}", XIOTModuleJsonTag::timestamp, (unsigned long)now());
+    module->sendJson(configResponse, 200);
   });
 
   /**
    * This endpoint allows agent modules to register themselves to master when they initialize
    */
-  server->on("/api/register", HTTP_POST, [](){
-    char *jsonString;
+  addRoute("/api/register", HTTP_POST, [](){
+    // When agents all register at once (swarm reset, master reboot), they are told when to come back
+    unsigned long notBefore = 0;
+    if(defaultAP && config->isAPInitialized()) {
+      notBefore = config->getDefaultAPExposition() + REGISTRATION_AP_SWITCH_DELAY;
+    }
+    unsigned long retryAfter = registrationPacer.admit(server->client().remoteIP(), notBefore);
+    if(retryAfter > 0) {
+      char retryMsg[40];
+      sprintf(retryMsg, "%lu", (retryAfter + 999) / 1000);
+      server->sendHeader("Retry-After", retryMsg);
+      sprintf(retryMsg, "{\"%s\":%lu}", JSON_TAG_RETRY_AFTER, retryAfter);
+      module->sendJson(retryMsg, 503);
+      return;
+    }
     Serial.println("Registering module");
-    // This will allocate jsonString
-    XUtils::stringToCharP(server->arg("plain"), &jsonString);
-    // agentCollection->add method need to copy the data since jsonString will be freed.
-    Serial.println(jsonString); 
-    Agent* agent = agentCollection->add(jsonString);
-    free(jsonString);
+    // The copy of the body is parsed in place by agentCollection->add, which copies what it keeps
+    RequestBody body(server->arg("plain"));
+    if(!checkRequestBody(&body)) return;
+    Serial.println(body.get()); 
+    Agent* agent = agentCollection->add(body.get());
+    recordRequestHeap();
     if(agent == NULL) {
       module->sendJson("{}", 500);
       oledDisplay->setLine(1, "Registration failed", TRANSIENT, NOT_BLINKING);
     } else {
+      forwardCache.invalidate(agent->getMAC());
       module->sendJson("{}", 200);
-      if(agent->getToRename()) {
-        agentToRename = agent;
-      }
     }
     char message[100];
     sprintf(message, "Registered modules: %d", agentCollection->getCount());
@@ -353,7 +490,7 @@ void addEndpoints() {
   /**
    * This endpoint allows removing a module
    */
-  server->on("/api/register", HTTP_DELETE, [](){
+  addRoute("/api/register", HTTP_DELETE, [](){
     char *jsonString;
     Serial.println("Unregistering module");
 
@@ -361,38 +498,49 @@ void addEndpoints() {
 
   // This endpoint is used by modules when they want to update data in the agent collection
   // (which is the data that the UI is polling)
-  server->on("/api/refresh", HTTP_POST, [](){
-    char *jsonString;
+  addRoute("/api/refresh", HTTP_POST, [](){
     Serial.println("Refreshing module");
-    // This will allocate jsonString
-    XUtils::stringToCharP(server->arg("plain"), &jsonString);
-    // agentCollection->add method need to copy the data since jsonString will be freed.
-    Serial.println(jsonString); 
-    Agent* agent = agentCollection->refresh(jsonString);
-    free(jsonString);
+    // The copy of the body is parsed in place by agentCollection->refresh, which copies what it keeps
+    RequestBody body(server->arg("plain"));
+    if(!checkRequestBody(&body)) return;
+    Serial.println(body.get()); 
+    Agent* agent = agentCollection->refresh(body.get());
+    recordRequestHeap();
     if(agent == NULL) {
       module->sendJson("{}", 500);
       oledDisplay->setLine(1, "Refreshing failed", TRANSIENT, NOT_BLINKING);
     } else {
+      // Agent data changed: what was cached from it is obsolete
+      forwardCache.invalidate(agent->getMAC());
       module->sendJson("{}", 200);
     }          
   });
   
   // TODO: remove this or make it better. Needed during dev
   // reset may be only possible by SMS from admin number ?
-  server->on("/api/swarmReset",  HTTP_GET, [](){
+  addRoute("/api/swarmReset", HTTP_GET, [](){
     Serial.println("Rq on /swarmReset");
-    agentCollection->reset();
-    config->initFromDefault();
-    config->saveToEeprom();
+    // Resetting every agent takes time: answer first
+    agentCollection->getWorkQueue()->push(swarmReset);
     module->sendJson("{}", 200);
-    gsm.sendSMS(config->getAdminNumber(), "Reset done");  // 
-    WiFi.mode(WIFI_AP);
-    initSoftAP();  
   });
 
+  // Data requests from the UI are relayed to the agent, and its response streamed back.
+  // Requests for the master itself are left to XIOTModule.
+  addFallThroughRoute("/api/data", HTTP_GET, forwardToAgent);
+  addFallThroughRoute("/api/data", HTTP_PUT, forwardToAgent);
+  addFallThroughRoute("/api/data", HTTP_POST, forwardToAgent);
+
+  /**
+   * Several agent commands in one request: [{"mac": "...", "path": "/api/data", "body": {...}}, ...]
+   * method is optional: POST when there is a body, GET otherwise.
+   * They are sent in parallel, and the http code of each one is returned in the same order
+   * (404 for unknown agents, 400 for commands without mac or path, or with an invalid method or path).
+   */
+  addRoute("/api/batch", HTTP_POST, executeBatch);
+
   // OTA: update 
-  server->on("/api/ota", HTTP_POST, [&]() {
+  addRoute("/api/ota", HTTP_POST, [&]() {
     String forwardTo = server->header("Xiot-forward-to");
     String jsonBody = server->arg("plain");
     int httpCode = 200;
@@ -401,8 +549,10 @@ void addEndpoints() {
       Serial.println(forwardTo);
       char message[SSID_MAX_LENGTH + PWD_MAX_LENGTH + 40];
       sprintf(message, "{\"%s\":\"%s\",\"%s\":\"%s\"}", XIOTModuleJsonTag::ssid, config->getHomeSsid(), XIOTModuleJsonTag::pwd, config->getHomePwd());
-      module->APIPost(forwardTo, "/api/ota", message, &httpCode, NULL, 0);
+      agentCollection->getHttpPool()->APIPost(forwardTo.c_str(), "/api/ota", message, &httpCode);
     } else {
+      // The module restarts after the update: pending config modifications must be saved first
+      config->flush(true);
       WiFi.mode(WIFI_OFF);
       delay(400);
       WiFi.mode(WIFI_STA);   
@@ -414,6 +564,227 @@ void addEndpoints() {
 }  
 
 
+/**
+ * GET responses of registered agents are cached for a short time, so that several clients
+ * displaying the same agent don't each cause a request to it. Other requests invalidate them.
+ * Returns false, without answering, for requests not meant to be forwarded.
+ */
+bool forwardToAgent() {
+  const String& forwardTo = server->header("Xiot-forward-to");
+  if(forwardTo.length() == 0) {
+    return false;
+  }
+  Agent* agent = agentCollection->getByIp(forwardTo.c_str());
+  if(agent != NULL && server->method() != HTTP_GET) {
+    forwardCache.invalidate(agent->getMAC());
+    agent = NULL;
+  }
+  const String& path = server->uri();
+  if(agent != NULL) {
+    const char* cached = forwardCache.get(agent->getMAC(), path.c_str());
+    if(cached != NULL) {
+      module->sendJson(cached, 200);
+      return true;
+    }
+  }
+  char response[FORWARD_CACHE_RESPONSE_MAX_SIZE + 1];
+  BufferStream copy(response, sizeof(response));
+  int httpCode = agentCollection->getHttpPool()->forward(forwardTo.c_str(), agent != NULL ? &copy : NULL);
+  if(agent != NULL && httpCode == 200 && !copy.isTruncated()) {
+    forwardCache.put(agent->getMAC(), path.c_str(), response);
+  }
+  return true;
+}
+
+void executeBatch() {
+  RequestBody body(server->arg("plain"));
+  if(!checkRequestBody(&body)) return;
+  // Strings in the copy of the request are not duplicated (parsed in place), but the json objects are
+  DynamicJsonBuffer jsonBuffer(BATCH_JSON_BUFFER_SIZE);
+  JsonArray& commands = jsonBuffer.parseArray(body.get());
+  if(!commands.success()) {
+    module->sendJson("{\"error\": \"Invalid batch.\"}", 400);
+    return;
+  }
+  int count = commands.size();
+  if(count > BATCH_MAX_COMMANDS) {
+    module->sendJson("{\"error\": \"Too many commands.\"}", 400);
+    return;
+  }
+  // Object bodies are printed back to json in this buffer. They may take more room than in the
+  // request (unquoted keys get quoted): they are measured.
+  int bodiesSize = 1;
+  for(int i = 0; i < count; i++) {
+    JsonObject& command = commands[i];
+    if(command.success() && command["body"].is<JsonObject>()) {
+      bodiesSize += command["body"].as<JsonObject>().measureLength() + 1;
+    }
+  }
+  char* bodies = (char *)malloc(bodiesSize);
+  if(bodies == NULL) {
+    module->sendJson("{}", 503);
+    return;
+  }
+  int bodiesLength = 0;
+  parallelRequestType requests[BATCH_MAX_COMMANDS];
+  int requestIndexes[BATCH_MAX_COMMANDS];  // -1 for commands not sent
+  int httpCodes[BATCH_MAX_COMMANDS];       // of the commands not sent
+  int requestCount = 0;
+  for(int i = 0; i < count; i++) {
+    requestIndexes[i] = -1;
+    // Not an object, or without mac or path: the command is invalid
+    JsonObject& command = commands[i];
+    const char* mac = command["mac"];
+    const char* path = command["path"];
+    if(!command.success() || mac == NULL || path == NULL) {
+      httpCodes[i] = 400;
+      continue;
+    }
+    Agent* agent = agentCollection->getByMac(mac);
+    if(agent == NULL) {
+      httpCodes[i] = 404;
+      continue;
+    }
+    parallelRequestType* request = &requests[requestCount];
+    request->ip = agent->getIP();
+    request->path = path;
+    request->body = NULL;
+    if(command["body"].is<JsonObject>()) {
+      request->body = bodies + bodiesLength;
+      bodiesLength += command["body"].as<JsonObject>().printTo(bodies + bodiesLength, bodiesSize - bodiesLength) + 1;
+    } else if(command["body"].is<const char*>()) {
+      request->body = command["body"];
+    }
+    const char* method = command["method"];
+    request->method = method != NULL ? method : (request->body == NULL ? "GET" : "POST");
+    // What's sent to an agent may change what it returns
+    forwardCache.invalidate(agent->getMAC());
+    requestIndexes[i] = requestCount++;
+  }
+  agentCollection->getParallelHttp()->execute(requests, requestCount);
+  free(bodies);
+  
+  char response[BATCH_MAX_COMMANDS * 5 + 20];
+  int length = sprintf(response, "{\"results\":[");
+  for(int i = 0; i < count; i++) {
+    int httpCode = requestIndexes[i] < 0 ? httpCodes[i] : requests[requestIndexes[i]].httpCode;
+    length += sprintf(response + length, "%s%d", i == 0 ? "" : ",", httpCode);
+  }
+  sprintf(response + length, "]}");
+  module->sendJson(response, 200);
+}
+
+/**
+ * Render the /api/config response, but for the timestamp
+ */
+void renderConfigResponse() {
+  StaticJsonBuffer<JSON_BUFFER_CONFIG_SIZE + JSON_OBJECT_SIZE(1)> jsonBuffer;    
+  // Create the root object
+  JsonObject& root = jsonBuffer.createObject();
+  root[XIOTModuleJsonTag::version] = API_VERSION ;
+  root[XIOTModuleJsonTag::APInitialized] = config->isAPInitialized();
+  root[XIOTModuleJsonTag::APSsid] = config->getApSsid(true);
+  root[XIOTModuleJsonTag::APPwd] = config->getApPwd(true);
+  root[XIOTModuleJsonTag::homeWifiConnected] = homeWifiConnected;
+  root[XIOTModuleJsonTag::gsmEnabled] = gsmEnabled;
+  root[XIOTModuleJsonTag::timeInitialized] = ntpTimeInitialized;
+  // Agents which know this field send UDP heartbeats, the others are still pinged over HTTP
+  root[JSON_TAG_HEARTBEAT_PORT] = HEARTBEAT_PORT;
+  int length = root.printTo(configResponse, sizeof(configResponse));
+  // Closing brace is added back with the timestamp
+  configResponsePrefixLength = length - 1;
+}
+
+// To be called whenever a field of the /api/config response may have changed
+void invalidateConfigResponse() {
+  configResponsePrefixLength = 0;
+}
+
+/**
+ * Check that the copy of the request body could be made, see RequestBody.
+ * If not, the error response is sent and false is returned.
+ */
+bool checkRequestBody(RequestBody* body) {
+  if(body->get() != NULL) {
+    return true;
+  }
+  if(body->isTooBig()) {
+    module->sendJson("{\"error\": \"Request body too big.\"}", 413);
+  } else {
+    module->sendJson("{\"error\": \"Not enough memory.\"}", 503);
+  }
+  return false;
+}
+
+/**
+ * Record the heap taken by the current request handler so far. Handlers parsing a body call it
+ * when the parsed data is still in use, which is when it takes the most.
+ */
+void recordRequestHeap() {
+#ifdef METRICS_ENABLED
+  uint32_t freeHeap = ESP.getFreeHeap();
+  metrics.recordValue(requestHeapMetricId, requestStartHeap > freeHeap ? requestStartHeap - freeHeap : 0);
+#endif
+}
+
+/**
+ * Register a route handler on the web server, measuring its latency when metrics are enabled.
+ * The uri is the metric name (several methods on a same uri share the metric)
+ * Requests go through admission control first: each route has its own rate limit.
+ */
+void addRoute(const char* uri, HTTPMethod method, ESP8266WebServer::THandlerFunction handler) {
+  // Registrations are already spread by registrationPacer, and agents get /api/config right
+  // before registering: a route rate there would reject the requests the pacer scheduled.
+  bool isPaced = strcmp(uri, "/api/register") == 0 || strcmp(uri, "/api/config") == 0;
+  TokenBucket* routeBucket = isPaced ? NULL : new TokenBucket(ADMISSION_ROUTE_RATE, ADMISSION_ROUTE_BURST);
+#ifdef METRICS_ENABLED
+  int metricId = metrics.add(uri);
+  server->on(uri, method, [metricId, routeBucket, handler]() {
+    METRIC_SCOPE(metricId);
+    if(!admission->admit(routeBucket)) return;
+    requestStartHeap = ESP.getFreeHeap();
+    handler();
+  });
+#else
+  server->on(uri, method, [routeBucket, handler]() {
+    if(!admission->admit(routeBucket)) return;
+    handler();
+  });
+#endif
+}
+
+/**
+ * Same as addRoute, for a handler which can decline a request: it's then served by the next
+ * handler registered for the same uri and method, see FallThroughHandler.
+ */
+void addFallThroughRoute(const char* uri, HTTPMethod method, fallThroughHandlerFunction handler) {
+  TokenBucket* routeBucket = new TokenBucket(ADMISSION_ROUTE_RATE, ADMISSION_ROUTE_BURST);
+#ifdef METRICS_ENABLED
+  int metricId = metrics.add(uri);
+  server->addHandler(new FallThroughHandler(uri, method, [metricId, routeBucket, handler]() {
+    METRIC_SCOPE(metricId);
+    if(!admission->admit(routeBucket)) return true;
+    requestStartHeap = ESP.getFreeHeap();
+    return handler();
+  }));
+#else
+  server->addHandler(new FallThroughHandler(uri, method, [routeBucket, handler]() {
+    if(!admission->admit(routeBucket)) return true;
+    return handler();
+  }));
+#endif
+}
+
+void swarmReset() {
+  agentCollection->reset();
+  config->initFromDefault();
+  config->requestSave();
+  invalidateConfigResponse();
+  gsm.sendSMS(config->getAdminNumber(), "Reset done");  // 
+  WiFi.mode(WIFI_AP);
+  initSoftAP();  
+}
+
 // Temp, for tests
 //void ping() {
 //  Serial.println("Ping");
@@ -560,7 +931,8 @@ void printHomePage() {
       // TODO: when GSM connected, send code, display confirmation page, 
       // and save once code confirmed
       // in the meantime, just save
-      config->saveToEeprom();
+      config->requestSave();
+      invalidateConfigResponse();
       
       // New Access Point
       WiFi.mode(WIFI_AP_STA);
@@ -712,73 +1084,136 @@ void wifiDisplay() {
 
 
 /*********************************
- * Main Loop
+ * Loop tasks
  *********************************/
-void loop() {
+void initTasks() {
+  // Serving requests and ingesting heartbeats come first in each loop iteration
+  scheduler.addPolling("web", serveRequests, PRIORITY_HIGH);
+  scheduler.addPolling("heartbeat", ingestHeartbeats, PRIORITY_HIGH);
+  scheduler.addPolling("events", processEvents);
+  scheduler.addPolling("work", processWorkQueue, PRIORITY_NORMAL, WORK_QUEUE_BUDGET);
+  scheduler.addPolling("gsm", refreshGsm);
+  scheduler.addPolling("internet", onInternetConnected, PRIORITY_LOW);
+  // Display needs to be refreshed periodically to handle blinking
+  scheduler.addPeriodic("display", refreshDisplay, DISPLAY_REFRESH_PERIOD, PRIORITY_LOW);
+  // Time on display should be refreshed every second
+  scheduler.addPeriodic("time", timeDisplay, 1000, PRIORITY_LOW);
+  // refresh wifi display every Xs to display both ssid/ips alternatively
+  scheduler.addPeriodic("wifi", wifiDisplay, 3500, PRIORITY_LOW);
+  scheduler.addPeriodic("httpPool", expireHttpConnections, 1000, PRIORITY_LOW);
+  scheduler.addPeriodic("softAP", checkSoftAP, 1000);
+  scheduler.addPeriodic("sweep", startSweep, MIN_PING_PERIOD*1000, PRIORITY_NORMAL, 100);
+  scheduler.addPeriodic("configSave", saveConfig, CONFIG_SAVE_CHECK_PERIOD, PRIORITY_LOW);
+  scheduler.addPeriodic("configJournal", compactConfigJournal, CONFIG_JOURNAL_CHECK_PERIOD, PRIORITY_LOW);
+}
 
-  if(module->isWaitingOTA()) {
-    oledDisplay->refresh();
-    ArduinoOTA.handle();
-    return;
-  }
-    
+// The web server handles one client per call, and a handler waiting for an agent blocks it:
+// clients are served one after the other.
+void serveRequests() {
+  server->handleClient();
+}
+
+// Ingest the heartbeats received from agents, if any
+void ingestHeartbeats() {
+  heartbeat->handle();
+}
+
+void processEvents() {
   if(ntpEventToProcess) {
     ntpEventToProcess = false;
     processNtpEvent();
   }
-
   now();  // Needed to refresh the Time lib, so that NTP server is called
-  // X seconds after reset, switch to custom AP if set
-  if(defaultAP && (millis() > config->getDefaultAPExposition()) && config->isAPInitialized()) {
-    defaultAP = false;
-    initSoftAP();
-  }
   
-  // check if any new added agent needs to be renamed
-  if(agentToRename != NULL) {
-    agentCollection->autoRename(agentToRename);
-    agentToRename = NULL;
-  }
-  
-  // Check if any request to serve
-  server->handleClient();
- 
-  // Let gsm do its tasks: checking connection, incomming messages, 
-  // handler notifications...
+  // Update agents which joined or left the Access Point
+  processStationEvents();
+}
+
+// Work deferred by request handlers and events: renaming agents, checking the ones that came back...
+void processWorkQueue() {
+  agentCollection->getWorkQueue()->drain();
+}
+
+// Let gsm do its tasks: checking connection, incomming messages, 
+// handler notifications...
+void refreshGsm() {
   gsm.refresh();   
-  
-  // Display needs to be refreshed periodically to handle blinking
+}
+
+void refreshDisplay() {
   oledDisplay->refresh();
+}
 
-  // Time on display should be refreshed every second
-  // Intentionnally not using the value returned by now(), since it changes
-  // when time is set.  
-  timeNow = millis();
-  
-  if(timeNow - timeLastTimeDisplay >= 1000) {
-    timeLastTimeDisplay = timeNow;
-    timeDisplay();
-  }
-  if(timeNow - timeLastWifiDisplay >= 3500) {
-    timeLastWifiDisplay = timeNow;
-    // refresh wifi display every Xs to display both ssid/ips alternatively
-    wifiDisplay();    
+// Close connections to agents that were not used recently
+void expireHttpConnections() {
+  agentCollection->getHttpPool()->expire();
+}
+
+void saveConfig() {
+  config->flush();
+}
+
+void compactConfigJournal() {
+  config->compactJournal();
+}
+
+// X seconds after reset, switch to custom AP if set
+void checkSoftAP() {
+  if(defaultAP && (millis() > config->getDefaultAPExposition()) && config->isAPInitialized()) {
+    defaultAP = false;
+    initSoftAP();
   }
-      
-  if(timeNow - timeLastPing >= MIN_PING_PERIOD*1000) {
-    timeLastPing = timeNow; 
-    agentCollection->ping();
-    uint32_t freeMem = system_get_free_heap_size();
-    Serial.printf("%s After ping Free heap mem: %d\n", NTP.getTimeDateString().c_str(), freeMem);  
-  } 
-  
-  // Things to do only once after connection to internet.
+}
+
+// Liveness check starts with one broadcast probe answered by every agent supporting heartbeats,
+// then once answers are collected, the other ones are pinged over HTTP
+void startSweep() {
+  heartbeat->sweep();
+  scheduler.addOneShot("ping", endSweep, HEARTBEAT_SWEEP_WINDOW);
+}
+
+void endSweep() {
+  Serial.printf("Sweep answers: %d\n", heartbeat->getSweepAnswerCount());
+  agentCollection->sweepDone(heartbeat->getSweepStart());
+  agentCollection->ping();
+  uint32_t freeMem = system_get_free_heap_size();
+  Serial.printf("%s After ping Free heap mem: %d\n", NTP.getTimeDateString().c_str(), freeMem);  
+}
+
+// Things to do only once after connection to internet.
+void onInternetConnected() {
   if(homeWifiFirstConnected) {
-  // Init ntp   
     initNtp();
     registerToWebsite();
     homeWifiFirstConnected = false;
   }
-  delay(20);
+}
+
+/*********************************
+ * Main Loop
+ *********************************/
+void loop() {
+
+  if(module->isWaitingOTA()) {
+    oledDisplay->refresh();
+    ArduinoOTA.handle();
+    return;
+  }
   
-}
\ No newline at end of file
+  scheduler.run();
+  // Sleep until next task is due, unless there is something to process before
+  scheduler.sleep(LOOP_MAX_SLEEP, onIdle);
+}
+
+/**
+ * Called every ms while the loop sleeps: incoming requests are served right away rather than
+ * waiting for the next loop iteration, and any other input wakes the loop up.
+ */
+bool onIdle() {
+  serveRequests();
+  return ntpEventToProcess 
+         || homeWifiFirstConnected
+         || (stationEventsHead != stationEventsTail)
+         || (Serial.available() > 0)
+         || (serialSIM800.available() > 0);
+}
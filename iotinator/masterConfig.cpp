@@ -5,9 +5,34 @@
  */
  
 #include "masterConfig.h"
+#include <EEPROM.h>
+
+/**
+ * Migrations of the data structure saved by previous versions, each one from a version to the next.
+ * When CONFIG_VERSION is bumped, the previous MasterConfigStruct is kept as MasterConfigStructV<n>
+ * and a migration copying its fields to the new layout is added here. For instance:
+ *
+ *   void migrateFromV4(const uint8_t* from, uint8_t* to) {
+ *     MasterConfigStructV4* old = (MasterConfigStructV4*)from;
+ *     MasterConfigStructV5* config = (MasterConfigStructV5*)to;
+ *     memcpy(config->name, old->name, sizeof(old->name));
+ *     ...
+ *   }
+ *
+ *   {4, sizeof(MasterConfigStructV4), sizeof(MasterConfigStructV5), migrateFromV4},
+ *
+ * Version and type, inherited from XEEPROMConfigDataStruct, must not be copied. The last migration
+ * writes to the data structure initialized with default values: fields it doesn't copy keep them.
+ * The list ends with a NULL migration.
+ */
+static const configMigrationType configMigrations[] = {
+  {0, 0, 0, NULL}
+};
 
 // TODO: use XIOTConfig as super class. 
 MasterConfigClass::MasterConfigClass(unsigned int version, const char* name):XEEPROMConfigClass(version, "iotinator", sizeof(MasterConfigStruct)) {
+  _version = version;
+  _journal = new ConfigJournal((uint8_t*)_getDataPtr(), sizeof(MasterConfigStruct));
   setName(name);
   // Initialize the array of RegisteredPhoneNumberClass objects from the data structure
   for(int i = 0; i < MAX_PHONE_NUMBERS; i++) {
@@ -15,6 +40,31 @@ MasterConfigClass::MasterConfigClass(unsigned int version, const char* name):XEE
   }  
 }
 
+/**
+ * Read the config from the flash journal. If it was saved by a previous version, it is migrated
+ * to the current one, or initialized from default values if no migration exists.
+ * The first time, the config saved in EEPROM by previous firmwares is imported in the journal.
+ * Without room in flash for the journal, the config is read from EEPROM.
+ * The data structure is then the same as in flash: nothing needs to be saved.
+ */
+void MasterConfigClass::init() {
+  uint16_t version;
+  uint16_t size;
+  if(!_journal->begin()) {
+    XEEPROMConfigClass::init();
+  } else if(!_journal->load(&version, &size)) {
+    XEEPROMConfigClass::init();
+    _journal->compact(_version);
+  } else if(version != _version || size != sizeof(MasterConfigStruct)) {
+    if(!_migrate(version, size)) {
+      Serial.printf("No migration of config version %d to %d, using default values\n", version, _version);
+      initFromDefault();
+    }
+    _journal->compact(_version);
+  }
+  _dirtyRangeCount = 0;
+}
+
 /**
  * Reset the config data structure to the default values.
  * This is done each time the data structure version is different from the one saved in EEPROM
@@ -22,6 +72,7 @@ MasterConfigClass::MasterConfigClass(unsigned int version, const char* name):XEE
  */
 void MasterConfigClass::initFromDefault() {
   XEEPROMConfigClass::initFromDefault(); // handles version init
+  _setDirty(_getDataPtr(), sizeof(MasterConfigStruct));
   setName(MODULE_NAME);
   // Reset all registered phone numbers
   for(int i = 0; i < MAX_PHONE_NUMBERS; i++) {
@@ -48,6 +99,7 @@ void MasterConfigClass::initFromDefault() {
   */
  void MasterConfigClass::setName(const char* name) {
    XUtils::safeStringCopy(_getDataPtr()->name, name, NAME_MAX_LENGTH);
+   _setDirty(_getDataPtr()->name, sizeof(_getDataPtr()->name));
  }
  
  /**
@@ -60,6 +112,7 @@ void MasterConfigClass::initFromDefault() {
  
 void MasterConfigClass::setHomeSsid(const char* ssid) {
   XUtils::safeStringCopy(_getDataPtr()->homeSsid, ssid, SSID_MAX_LENGTH);
+  _setDirty(_getDataPtr()->homeSsid, sizeof(_getDataPtr()->homeSsid));
 }
 void MasterConfigClass::setHomeSsid(String ssidString) {
   char ssid[SSID_MAX_LENGTH + 1];
@@ -68,6 +121,7 @@ void MasterConfigClass::setHomeSsid(String ssidString) {
 }
 void MasterConfigClass::setHomePwd(const char* pwd) {
   XUtils::safeStringCopy(_getDataPtr()->homePwd, pwd, PWD_MAX_LENGTH);
+  _setDirty(_getDataPtr()->homePwd, sizeof(_getDataPtr()->homePwd));
 }
 void MasterConfigClass::setHomePwd(String pwdString) {
   char pwd[PWD_MAX_LENGTH + 1];
@@ -77,9 +131,11 @@ void MasterConfigClass::setHomePwd(String pwdString) {
 
 void MasterConfigClass::setApSsid(const char* ssid) {
   XUtils::safeStringCopy(_getDataPtr()->apSsid, ssid, SSID_MAX_LENGTH);
+  _setDirty(_getDataPtr()->apSsid, sizeof(_getDataPtr()->apSsid));
 }
 void MasterConfigClass::setApiKey(const char* apiKey) {
   XUtils::safeStringCopy(_getDataPtr()->apiKey, apiKey, API_KEY_MAX_LENGTH);
+  _setDirty(_getDataPtr()->apiKey, sizeof(_getDataPtr()->apiKey));
 }
 void MasterConfigClass::setApiKey(String apiKeyString) {
   char apiKey[HOSTNAME_MAX_LENGTH + 1];
@@ -88,6 +144,7 @@ void MasterConfigClass::setApiKey(String apiKeyString) {
 }
 void MasterConfigClass::setWebSite(const char* webSite) {
   XUtils::safeStringCopy(_getDataPtr()->webSite, webSite, HOSTNAME_MAX_LENGTH);
+  _setDirty(_getDataPtr()->webSite, sizeof(_getDataPtr()->webSite));
 }
 void MasterConfigClass::setWebSite(String webSiteString) {
   char webSite[HOSTNAME_MAX_LENGTH + 1];
@@ -96,6 +153,7 @@ void MasterConfigClass::setWebSite(String webSiteString) {
 }
 void MasterConfigClass::setNtpServer(const char* ntpServer) {
   XUtils::safeStringCopy(_getDataPtr()->ntpHostName, ntpServer, HOSTNAME_MAX_LENGTH);
+  _setDirty(_getDataPtr()->ntpHostName, sizeof(_getDataPtr()->ntpHostName));
 }
 void MasterConfigClass::setNtpServer(String ntpServerString) {
   char ntpServer[HOSTNAME_MAX_LENGTH + 1];
@@ -110,6 +168,7 @@ void MasterConfigClass::setApSsid(String ssidString) {
 }
 void MasterConfigClass::setApPwd(const char* pwd) {
   XUtils::safeStringCopy(_getDataPtr()->apPwd, pwd, PWD_MAX_LENGTH);
+  _setDirty(_getDataPtr()->apPwd, sizeof(_getDataPtr()->apPwd));
 }
 void MasterConfigClass::setApPwd(String pwdString) {
   char pwd[PWD_MAX_LENGTH + 1];
@@ -152,6 +211,7 @@ char* MasterConfigClass::getApPwd(bool force) {
 
 void MasterConfigClass::setDefaultAPExposition(int msDelay) {
   _getDataPtr()->defaultAPExposition = msDelay;
+  _setDirty(&_getDataPtr()->defaultAPExposition, sizeof(_getDataPtr()->defaultAPExposition));
 }
 int MasterConfigClass::getDefaultAPExposition(void) {
   return _getDataPtr()->defaultAPExposition;
@@ -160,6 +220,7 @@ int MasterConfigClass::getDefaultAPExposition(void) {
 void MasterConfigClass::setAdminNumber(char *number) {
   _phoneNumbers[0]->setNumber(number);
   _phoneNumbers[0]->setAdmin(true);
+  _setDirty(&_getDataPtr()->registeredNumbers[0], sizeof(phoneNumberDataType));
 }
 char* MasterConfigClass::getAdminNumber() {
   return _phoneNumbers[0]->getNumber();
@@ -174,6 +235,8 @@ void MasterConfigClass::setAdminNumber(String numberString) {
 void MasterConfigClass::setGmtOffset(int8_t hour, int8_t min) {
   _getDataPtr()->gmtHourOffset = hour;
   _getDataPtr()->gmtMinOffset = min;
+  _setDirty(&_getDataPtr()->gmtHourOffset, sizeof(_getDataPtr()->gmtHourOffset));
+  _setDirty(&_getDataPtr()->gmtMinOffset, sizeof(_getDataPtr()->gmtMinOffset));
 } 
 int8_t MasterConfigClass::getGmtHourOffset() {
   return _getDataPtr()->gmtHourOffset;
@@ -225,4 +288,197 @@ RegisteredPhoneNumberClass* MasterConfigClass::getRegisteredPhoneByNumber(const
  */
 MasterConfigStruct* MasterConfigClass::_getDataPtr(void) {
   return (MasterConfigStruct*)XEEPROMConfigClass::_getDataPtr();
-}
\ No newline at end of file
+}
+
+/**
+ * Save the modified parts of the data structure, if any, appending them to the journal.
+ * Without journal, they are written to EEPROM. The EEPROM is emulated in a flash sector
+ * that is erased and rewritten on each commit: nothing is committed if nothing changed.
+ * The data structure is at the beginning of the EEPROM, as saved by XEEPROMConfigClass.
+ */
+void MasterConfigClass::saveToEeprom() {
+  if(_dirtyRangeCount == 0) {
+    return;
+  }
+  _countFlashWrite();
+  if(_journal->isReady()) {
+    for(int i = 0; i < _dirtyRangeCount; i++) {
+      if(!_journal->append(_dirtyRanges[i].start, _dirtyRanges[i].end - _dirtyRanges[i].start)) {
+        // Ranges not appended are kept dirty, to be saved next time
+        memmove(_dirtyRanges, &_dirtyRanges[i], (_dirtyRangeCount - i) * sizeof(dirtyRangeType));
+        _dirtyRangeCount -= i;
+        return;
+      }
+    }
+    _dirtyRangeCount = 0;
+    return;
+  }
+  uint8_t* data = (uint8_t*)_getDataPtr();
+  EEPROM.begin(sizeof(MasterConfigStruct));
+  for(int i = 0; i < _dirtyRangeCount; i++) {
+    for(unsigned int address = _dirtyRanges[i].start; address < _dirtyRanges[i].end; address++) {
+      EEPROM.write(address, data[address]);
+    }
+  }
+  EEPROM.end();
+  _dirtyRangeCount = 0;
+}
+
+bool MasterConfigClass::isDirty() {
+  return _dirtyRangeCount > 0;
+}
+
+/**
+ * Save the config once it stops being modified, see flush()
+ */
+void MasterConfigClass::requestSave() {
+  if(!_saveRequested) {
+    _saveRequested = true;
+    _saveRequestedAt = millis();
+  }
+  _modifiedAt = millis();
+}
+
+/**
+ * Do the requested save if the config was not modified for the quiet period, if it has been waiting
+ * for too long, or if forced (before a restart for instance). Returns true if saved.
+ * When the save fails, it's retried after another quiet period.
+ */
+bool MasterConfigClass::flush(bool force) {
+  if(!_saveRequested) return false;
+  unsigned long now = millis();
+  if(!force && now - _modifiedAt < CONFIG_SAVE_QUIET_PERIOD && now - _saveRequestedAt < CONFIG_SAVE_MAX_DELAY) {
+    return false;
+  }
+  saveToEeprom();
+  // Ranges that could not be written are still dirty: the save stays requested, and is retried
+  _saveRequested = isDirty();
+  if(_saveRequested) {
+    _saveRequestedAt = now;
+    _modifiedAt = now;
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Compact the journal ahead of time, when it is almost full, so that saving doesn't have to.
+ * The whole data structure is written: modified parts not saved yet are saved too.
+ */
+void MasterConfigClass::compactJournal() {
+  if(!_journal->needsCompaction()) return;
+  _countFlashWrite();
+  if(_journal->compact(_version)) {
+    _dirtyRangeCount = 0;
+    _saveRequested = false;
+  }
+}
+
+/**
+ * Migrate the data structure saved in the journal by a previous version, one version at a time.
+ * Returns false if a migration is missing: the data structure then holds default values.
+ */
+bool MasterConfigClass::_migrate(unsigned int version, uint16_t size) {
+  uint8_t* data = (uint8_t*)malloc(size);
+  if(data == NULL || !_journal->replay(data, size)) {
+    free(data);
+    return false;
+  }
+  initFromDefault();
+  while(version < _version) {
+    const configMigrationType* migration = configMigrations;
+    while(migration->migrate != NULL && (migration->fromVersion != version || migration->fromSize != size)) {
+      migration ++;
+    }
+    if(migration->migrate == NULL) break;
+    if(version + 1 == _version) {
+      if(migration->toSize != sizeof(MasterConfigStruct)) break;
+      migration->migrate(data, (uint8_t*)_getDataPtr());
+      free(data);
+      Serial.printf("Config migrated to version %d\n", _version);
+      return true;
+    }
+    uint8_t* next = (uint8_t*)calloc(migration->toSize, 1);
+    if(next == NULL) break;
+    migration->migrate(data, next);
+    free(data);
+    data = next;
+    size = migration->toSize;
+    version ++;
+  }
+  free(data);
+  return false;
+}
+
+unsigned long MasterConfigClass::getFlashWriteCount() {
+  return _flashWriteCount;
+}
+
+/**
+ * Number of flash writes during the last 24 hours period, or so far if the module started less than a day ago
+ */
+unsigned long MasterConfigClass::getFlashWritesPerDay() {
+  _rollDay();
+  return _dayCompleted ? _previousDayWriteCount : _dayWriteCount;
+}
+
+void MasterConfigClass::_countFlashWrite() {
+  _rollDay();
+  _flashWriteCount ++;
+  _dayWriteCount ++;
+}
+
+void MasterConfigClass::_rollDay() {
+  while(millis() - _dayStart >= DAY_DURATION) {
+    _previousDayWriteCount = _dayWriteCount;
+    _dayWriteCount = 0;
+    _dayStart += DAY_DURATION;
+    _dayCompleted = true;
+  }
+}
+
+/**
+ * Record that a field of the data structure was modified. Overlapping or contiguous ranges are merged,
+ * and if there are too many ranges, they all are merged into one.
+ */
+void MasterConfigClass::_setDirty(void* field, unsigned int size) {
+  _modifiedAt = millis();
+  uint16_t start = (uint8_t*)field - (uint8_t*)_getDataPtr();
+  uint16_t end = start + size;
+  for(int i = 0; i < _dirtyRangeCount; i++) {
+    dirtyRangeType* range = &_dirtyRanges[i];
+    if(start <= range->end && end >= range->start) {
+      range->start = start < range->start ? start : range->start;
+      range->end = end > range->end ? end : range->end;
+      // The extended range may now reach the next ones: they are merged into it, and the
+      // search starts again since it was extended once more
+      int j = i + 1;
+      while(j < _dirtyRangeCount) {
+        dirtyRangeType* other = &_dirtyRanges[j];
+        if(other->start <= range->end && other->end >= range->start) {
+          range->start = other->start < range->start ? other->start : range->start;
+          range->end = other->end > range->end ? other->end : range->end;
+          _dirtyRanges[j] = _dirtyRanges[_dirtyRangeCount - 1];
+          _dirtyRangeCount --;
+          j = i + 1;
+        } else {
+          j ++;
+        }
+      }
+      return;
+    }
+  }
+  if(_dirtyRangeCount == MAX_DIRTY_RANGES) {
+    for(int i = 1; i < _dirtyRangeCount; i++) {
+      start = _dirtyRanges[i].start < start ? _dirtyRanges[i].start : start;
+      end = _dirtyRanges[i].end > end ? _dirtyRanges[i].end : end;
+    }
+    _dirtyRangeCount = 1;
+    _dirtyRanges[0].start = start < _dirtyRanges[0].start ? start : _dirtyRanges[0].start;
+    _dirtyRanges[0].end = end > _dirtyRanges[0].end ? end : _dirtyRanges[0].end;
+    return;
+  }
+  _dirtyRanges[_dirtyRangeCount].start = start;
+  _dirtyRanges[_dirtyRangeCount].end = end;
+  _dirtyRangeCount ++;
+}
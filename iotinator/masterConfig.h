@@ -7,6 +7,7 @@
 #pragma once
 #include <Arduino.h>
 #include "registeredPhoneNumber.h"
+#include "ConfigJournal.h"
 #include <XIOTConfig.h>
 #include <XUtils.h>
 
@@ -23,6 +24,31 @@
 #define DEFAULT_GMT_HOUR_OFFSSET 2
 #define DEFAULT_GMT_MIN_OFFSSET 0
 
+// Ranges of the data structure modified since last save. When more ranges are modified,
+// they are merged into one.
+#define MAX_DIRTY_RANGES 4
+
+// A requested save is done once the config was not modified for CONFIG_SAVE_QUIET_PERIOD, so that
+// a sequence of modifications costs one flash write, but no later than CONFIG_SAVE_MAX_DELAY
+#define CONFIG_SAVE_QUIET_PERIOD 2000  // ms
+#define CONFIG_SAVE_MAX_DELAY 10000    // ms
+#define DAY_DURATION 86400000UL        // ms
+
+// Conversion of the data structure saved by a previous version to the layout of the next version
+typedef void (*configMigrationFunction)(const uint8_t* from, uint8_t* to);
+
+typedef struct {
+  unsigned int fromVersion;
+  uint16_t fromSize;  // size of the data structure in fromVersion
+  uint16_t toSize;    // size of the data structure in fromVersion + 1
+  configMigrationFunction migrate;
+} configMigrationType;
+
+typedef struct {
+  uint16_t start;
+  uint16_t end;  // excluded
+} dirtyRangeType;
+
 struct MasterConfigStruct:XEEPROMConfigDataStruct {
   // First 2 members (version and type) are inherited from XEEPROMConfigDataStruct   
   char name[NAME_MAX_LENGTH + 1]; 
@@ -57,7 +83,15 @@ struct MasterConfigStruct:XEEPROMConfigDataStruct {
 class MasterConfigClass:public XEEPROMConfigClass {
 public:
   MasterConfigClass(unsigned int version, const char* name);
+  void init(void);
   virtual void initFromDefault(void) override;
+  void saveToEeprom(void);
+  bool isDirty(void);
+  void requestSave(void);
+  bool flush(bool force = false);
+  void compactJournal(void);
+  unsigned long getFlashWriteCount(void);
+  unsigned long getFlashWritesPerDay(void);
   
   RegisteredPhoneNumberClass* getRegisteredPhoneByNumber(const char* number); 
   RegisteredPhoneNumberClass* getRegisteredPhone(unsigned int offset); 
@@ -100,5 +134,21 @@ public:
   
 protected:
   RegisteredPhoneNumberClass* _phoneNumbers[MAX_PHONE_NUMBERS];
+  dirtyRangeType _dirtyRanges[MAX_DIRTY_RANGES];
+  int _dirtyRangeCount = 0;
+  unsigned int _version;
+  ConfigJournal* _journal;
+  bool _saveRequested = false;
+  unsigned long _saveRequestedAt = 0;
+  unsigned long _modifiedAt = 0;
+  unsigned long _flashWriteCount = 0;
+  unsigned long _dayStart = 0;
+  unsigned long _dayWriteCount = 0;
+  unsigned long _previousDayWriteCount = 0;
+  bool _dayCompleted = false;
+  bool _migrate(unsigned int version, uint16_t size);
+  void _countFlashWrite(void);
+  void _rollDay(void);
   MasterConfigStruct* _getDataPtr(void);  
+  void _setDirty(void* field, unsigned int size);
 };
@@ -0,0 +1,92 @@
+/**
+ *  Host benchmark of the latency of commands forwarded to agents, with and without the connection pool
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ *
+ *  The network is simulated by the HTTPClient stub: opening a connection and each exchange cost the
+ *  durations below, in simulated time. The pool logic is the real one, so the result shows how many
+ *  connections the pool saves for each workload, and what it means for the latency.
+ */
+
+#include <algorithm>
+#include <vector>
+#include "AgentHttpPool.h"
+
+// TCP handshake with an agent on the Access Point, and request/response exchange (ms)
+#define CONNECT_TIME 20
+#define EXCHANGE_TIME 15
+#define COMMAND_COUNT 200
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+const char* agentIps[] = {"192.168.4.10", "192.168.4.11", "192.168.4.12"};
+
+typedef struct {
+  unsigned long p50;
+  unsigned long p99;
+  unsigned long connections;
+} latencyType;
+
+/**
+ * Forward commands to agentCount agents in turn, one every period ms.
+ * Without the pool, connections are closed after each command, like XIOTModule does.
+ */
+latencyType forwardCommands(int agentCount, unsigned long period, bool pooled) {
+  XIOTModule module;
+  AgentHttpPool pool(&module);
+  ESP8266WebServer* server = module.getServer();
+  server->requestMethod = HTTP_POST;
+  server->requestUri = "/api/data";
+  server->requestBody = "{\"on\":true}";
+  stubAgentResponse = "{\"on\":true}";
+  stubConnectCount = 0;
+  stubMillis = 1000;
+  std::vector<unsigned long> latencies;
+  for(int i = 0; i < COMMAND_COUNT; i++) {
+    stubMillis += period;
+    // Called by the loop between requests
+    pool.expire();
+    if(!pooled) {
+      pool.closeAll();
+    }
+    server->response.clear();
+    unsigned long start = stubMillis;
+    int httpCode = pool.forward(agentIps[i % agentCount]);
+    latencies.push_back(stubMillis - start);
+    CHECK(httpCode == 200);
+    CHECK(server->responseCode == 200);
+    CHECK(server->response == "{\"on\":true}");
+  }
+  std::sort(latencies.begin(), latencies.end());
+  latencyType result;
+  result.p50 = latencies[COMMAND_COUNT / 2];
+  result.p99 = latencies[COMMAND_COUNT * 99 / 100];
+  result.connections = stubConnectCount;
+  return result;
+}
+
+void compare(const char* name, int agentCount, unsigned long period, unsigned long expectedConnections) {
+  latencyType pooled = forwardCommands(agentCount, period, true);
+  latencyType unpooled = forwardCommands(agentCount, period, false);
+  printf("%-42s with pool p50 %3lu ms p99 %3lu ms %3lu connections, without p50 %3lu ms p99 %3lu ms %3lu connections\n",
+         name, pooled.p50, pooled.p99, pooled.connections, unpooled.p50, unpooled.p99, unpooled.connections);
+  CHECK(unpooled.connections == COMMAND_COUNT);
+  CHECK(pooled.connections == expectedConnections);
+  CHECK(pooled.p50 <= unpooled.p50);
+}
+
+int main() {
+  stubConnectTime = CONNECT_TIME;
+  stubExchangeTime = EXCHANGE_TIME;
+  printf("Forwarded commands, connection %d ms, exchange %d ms\n", CONNECT_TIME, EXCHANGE_TIME);
+  compare("1 agent, every second", 1, 1000, 1);
+  compare("2 agents in turn, every second", 2, 1000, 2);
+  // More agents than pooled connections: least recently used one is always the next one
+  compare("3 agents in turn, every second", 3, 1000, COMMAND_COUNT);
+  // Idle connections are closed before the next command
+  compare("1 agent, less often than the idle timeout", 1, HTTP_POOL_IDLE_TIMEOUT + 1000, COMMAND_COUNT);
+  printf("AgentHttpPool: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
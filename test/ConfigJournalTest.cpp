@@ -0,0 +1,181 @@
+/**
+ *  Host test and benchmark of the config journal on the flash emulator: power cuts during saves
+ *  and compactions, and flash use at boot and for each save
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "ConfigJournal.h"
+#include "masterConfig.h"
+#include "spi_flash.h"
+#include "EEPROM.h"
+
+#define DATA_SIZE sizeof(MasterConfigStruct)
+#define VERSION 4
+#define FIELD_OFFSET 100
+#define FIELD_SIZE 20
+// Records are padded to 4 bytes
+#define PADDED_LENGTH(length) (((length) + 3) & ~3)
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+// Gives access to the position of the next record
+class TestJournal:public ConfigJournal {
+public:
+  TestJournal(uint8_t* data):ConfigJournal(data, DATA_SIZE) {}
+  uint32_t getWriteOffset() { return _writeOffset; }
+  int getActive() { return _active; }
+};
+
+uint8_t data[DATA_SIZE];
+uint8_t loaded[DATA_SIZE];
+
+void fill(uint8_t value) {
+  memset(data + FIELD_OFFSET, value, FIELD_SIZE);
+}
+
+// Power is back: the journal is read by a module starting again
+bool reboot(TestJournal** journal) {
+  uint16_t version;
+  uint16_t size;
+  stubFlashReboot();
+  memset(loaded, 0, DATA_SIZE);
+  *journal = new TestJournal(loaded);
+  return (*journal)->begin() && (*journal)->load(&version, &size) && version == VERSION && size == DATA_SIZE;
+}
+
+// Journal with the whole data structure, and one record
+TestJournal* start() {
+  stubFlashErase();
+  for(unsigned int i = 0; i < DATA_SIZE; i++) {
+    data[i] = i;
+  }
+  TestJournal* journal = new TestJournal(data);
+  journal->begin();
+  journal->compact(VERSION);
+  fill(1);
+  journal->append(FIELD_OFFSET, FIELD_SIZE);
+  return journal;
+}
+
+// A record cut by a power loss is ignored, and nothing is appended after it anymore
+void testPartialRecord() {
+  TestJournal* journal = start();
+  fill(2);
+  stubFlashPowerCutAfter = sizeof(configJournalRecordType) + 4;
+  CHECK(!journal->append(FIELD_OFFSET, FIELD_SIZE));
+  delete journal;
+  
+  CHECK(reboot(&journal));
+  fill(1);
+  CHECK(memcmp(loaded, data, DATA_SIZE) == 0);
+  CHECK(journal->getWriteOffset() == SPI_FLASH_SEC_SIZE);
+  CHECK(journal->needsCompaction());
+  // Next save goes to the other sector
+  int active = journal->getActive();
+  loaded[FIELD_OFFSET] = 3;
+  CHECK(journal->append(FIELD_OFFSET, FIELD_SIZE));
+  CHECK(journal->getActive() != active);
+  delete journal;
+  CHECK(reboot(&journal));
+  CHECK(loaded[FIELD_OFFSET] == 3);
+  delete journal;
+}
+
+// The header of a new sector is written last: if power is cut before, the previous sector is still used
+void testCompactionCutBeforeHeader() {
+  TestJournal* journal = start();
+  int active = journal->getActive();
+  fill(2);
+  stubFlashPowerCutAfter = sizeof(configJournalRecordType) + PADDED_LENGTH(DATA_SIZE);
+  CHECK(!journal->compact(VERSION));
+  delete journal;
+  
+  CHECK(reboot(&journal));
+  CHECK(journal->getActive() == active);
+  fill(1);
+  CHECK(memcmp(loaded, data, DATA_SIZE) == 0);
+  delete journal;
+}
+
+// Whenever power is cut during a save or a compaction, the config read at boot is the one before or after
+void testPowerCutAnywhere() {
+  uint8_t before[DATA_SIZE];
+  uint8_t after[DATA_SIZE];
+  for(int compaction = 0; compaction <= 1; compaction++) {
+    unsigned long bytesToWrite = compaction ? sizeof(configJournalRecordType) + PADDED_LENGTH(DATA_SIZE) + sizeof(configJournalHeaderType)
+                                            : sizeof(configJournalRecordType) + PADDED_LENGTH(FIELD_SIZE);
+    for(unsigned long cut = 0; cut <= bytesToWrite; cut++) {
+      TestJournal* journal = start();
+      memcpy(before, data, DATA_SIZE);
+      fill(2);
+      memcpy(after, data, DATA_SIZE);
+      stubFlashPowerCutAfter = cut;
+      bool saved = compaction ? journal->compact(VERSION) : journal->append(FIELD_OFFSET, FIELD_SIZE);
+      delete journal;
+      
+      CHECK(reboot(&journal));
+      CHECK(memcmp(loaded, saved ? after : before, DATA_SIZE) == 0);
+      delete journal;
+    }
+  }
+}
+
+/**
+ * Flash read at boot and written by a save of one field, with the journal and with the whole
+ * data structure in EEPROM. Boot reads more as records accumulate, until the journal is compacted.
+ */
+void benchmark() {
+  TestJournal* journal = start();
+  int appends = 0;
+  unsigned long appendBytes = 0;
+  unsigned long bootBytes[3] = {0};
+  int bootAppends[3] = {0};
+  while(!journal->needsCompaction()) {
+    stubFlashResetCounters();
+    fill(appends);
+    journal->append(FIELD_OFFSET, FIELD_SIZE);
+    appendBytes += stubFlashBytesWritten;
+    appends ++;
+    if(appends == 1 || appends == 30 || journal->needsCompaction()) {
+      int index = appends == 1 ? 0 : appends == 30 ? 1 : 2;
+      TestJournal* bootJournal;
+      stubFlashResetCounters();
+      CHECK(reboot(&bootJournal));
+      bootBytes[index] = stubFlashBytesRead;
+      bootAppends[index] = appends + 1;
+      delete bootJournal;
+    }
+  }
+  delete journal;
+  
+  stubFlashResetCounters();
+  EEPROM.begin(DATA_SIZE);
+  EEPROM.end();
+  unsigned long eepromBootBytes = stubFlashBytesRead;
+  EEPROM.begin(DATA_SIZE);
+  EEPROM.write(FIELD_OFFSET, EEPROM.read(FIELD_OFFSET) + 1);
+  EEPROM.end();
+  unsigned long eepromSaveBytes = stubFlashBytesWritten;
+  
+  printf("Config journal, %d bytes data structure, %d bytes field: save %lu bytes written, no erase, "
+         "compaction after %d saves\n", (int)DATA_SIZE, FIELD_SIZE, appendBytes / appends, appends);
+  printf("  boot reads %lu bytes with %d records, %lu with %d, %lu with %d\n",
+         bootBytes[0], bootAppends[0], bootBytes[1], bootAppends[1], bootBytes[2], bootAppends[2]);
+  printf("EEPROM: save %lu bytes written and 1 erase, boot reads %lu bytes\n", eepromSaveBytes, eepromBootBytes);
+  CHECK(appendBytes / appends == sizeof(configJournalRecordType) + PADDED_LENGTH(FIELD_SIZE));
+  CHECK(appendBytes / appends * 10 < eepromSaveBytes);
+  // Boot reads both headers, and the records twice: to check them, then to apply them
+  CHECK(bootBytes[2] <= 2 * sizeof(configJournalHeaderType) + 2 * (unsigned long)SPI_FLASH_SEC_SIZE);
+}
+
+int main() {
+  testPartialRecord();
+  testCompactionCutBeforeHeader();
+  testPowerCutAnywhere();
+  benchmark();
+  printf("ConfigJournal: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
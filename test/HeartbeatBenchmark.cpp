@@ -0,0 +1,198 @@
+/**
+ *  Host test and benchmark of the UDP heartbeat ingestion, compared to scanning an HTTP ping response
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ *
+ *  Only the CPU spent by the master is measured, on the host: the HTTP ping also costs a TCP
+ *  connection and the request and response headers, which are not counted here.
+ */
+
+#include <chrono>
+#include "Heartbeat.h"
+#include "PingResponseScanner.h"
+
+#define AGENT_COUNT 100
+#define BENCHMARK_HEARTBEATS 1000000
+#define PING_RESPONSE "{\"heap\":21560,\"custom\":\"{\\\"on\\\":true}\"}"
+#define CUSTOM "{\"on\":true}"
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+// Gives access to the socket, to queue the datagrams
+class TestHeartbeat:public Heartbeat {
+public:
+  TestHeartbeat(heartbeatHandler handler):Heartbeat(handler) {}
+  WiFiUDP* getUdp() { return &_udp; }
+};
+
+// Registered agents, looked up the way AgentCollection::getByMac does
+typedef struct {
+  char mac[MAC_ADDR_MAX_LENGTH + 1];
+  uint32_t heap;
+  char custom[MAX_CUSTOM_DATA_SIZE + 1];
+  unsigned long heartbeats;
+} testAgentType;
+testAgentType agents[AGENT_COUNT];
+
+void macOf(int agent, uint8_t* mac) {
+  uint8_t agentMac[6] = {0x5c, 0xcf, 0x7f, 0x10, 0x00, (uint8_t)agent};
+  memcpy(mac, agentMac, 6);
+}
+
+void registerAgents() {
+  for(int i = 0; i < AGENT_COUNT; i++) {
+    uint8_t mac[6];
+    macOf(i, mac);
+    sprintf(agents[i].mac, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    agents[i].heap = 0;
+    agents[i].custom[0] = 0;
+    agents[i].heartbeats = 0;
+  }
+}
+
+bool ingest(const uint8_t* mac, uint32_t heap, const char* custom, int customSize) {
+  char macStr[MAC_ADDR_MAX_LENGTH + 1];
+  sprintf(macStr, "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  for(int i = 0; i < AGENT_COUNT; i++) {
+    if(strcasecmp(agents[i].mac, macStr) == 0) {
+      agents[i].heap = heap;
+      if((int)strlen(agents[i].custom) != customSize || memcmp(agents[i].custom, custom, customSize) != 0) {
+        memcpy(agents[i].custom, custom, customSize);
+        agents[i].custom[customSize] = 0;
+      }
+      agents[i].heartbeats ++;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<uint8_t> datagram(int agent, uint8_t type, uint16_t sequence, uint32_t heap, const char* custom) {
+  int customSize = strlen(custom);
+  std::vector<uint8_t> packet(HEARTBEAT_HEADER_SIZE + customSize);
+  packet[0] = HEARTBEAT_MAGIC_0;
+  packet[1] = HEARTBEAT_MAGIC_1;
+  packet[2] = HEARTBEAT_PROTOCOL_VERSION;
+  packet[3] = type;
+  packet[4] = sequence & 0xFF;
+  packet[5] = sequence >> 8;
+  macOf(agent, &packet[6]);
+  for(int i = 0; i < 4; i++) {
+    packet[12 + i] = (heap >> (8 * i)) & 0xFF;
+  }
+  packet[16] = customSize & 0xFF;
+  packet[17] = customSize >> 8;
+  memcpy(packet.data() + HEARTBEAT_HEADER_SIZE, custom, customSize);
+  return packet;
+}
+
+void testIngestion() {
+  registerAgents();
+  TestHeartbeat heartbeat(ingest);
+  WiFiUDP* udp = heartbeat.getUdp();
+  udp->incoming.push_back(datagram(3, HEARTBEAT_TYPE_BEAT, 0, 21560, CUSTOM));
+  CHECK(heartbeat.handle() == 1);
+  CHECK(agents[3].heap == 21560);
+  CHECK(strcmp(agents[3].custom, CUSTOM) == 0);
+  
+  // Rejected: unknown agent, wrong magic, probe, custom data longer than the datagram, oversized
+  udp->incoming.push_back(datagram(AGENT_COUNT + 1, HEARTBEAT_TYPE_BEAT, 0, 1, ""));
+  std::vector<uint8_t> packet = datagram(4, HEARTBEAT_TYPE_BEAT, 0, 1, "");
+  packet[1] = 'Y';
+  udp->incoming.push_back(packet);
+  udp->incoming.push_back(datagram(4, HEARTBEAT_TYPE_PROBE, 0, 1, ""));
+  packet = datagram(4, HEARTBEAT_TYPE_BEAT, 0, 1, CUSTOM);
+  packet.pop_back();
+  udp->incoming.push_back(packet);
+  udp->incoming.push_back(std::vector<uint8_t>(HEARTBEAT_MAX_SIZE + 1, 'X'));
+  CHECK(heartbeat.handle() == 0);
+  CHECK(heartbeat.getRejectedCount() == 5);
+  CHECK(agents[4].heartbeats == 0);
+  
+  // A burst is ingested over several loop iterations
+  for(int i = 0; i < HEARTBEAT_MAX_PER_HANDLE + 2; i++) {
+    udp->incoming.push_back(datagram(i, HEARTBEAT_TYPE_BEAT, 0, 1, ""));
+  }
+  CHECK(heartbeat.handle() == HEARTBEAT_MAX_PER_HANDLE);
+  CHECK(heartbeat.handle() == 2);
+  CHECK(heartbeat.handle() == 0);
+  CHECK(heartbeat.getReceivedCount() == HEARTBEAT_MAX_PER_HANDLE + 3);
+}
+
+// Answers to a sweep carry the sequence number of the probe
+void testSweep() {
+  registerAgents();
+  TestHeartbeat heartbeat(ingest);
+  WiFiUDP* udp = heartbeat.getUdp();
+  heartbeat.sweep();
+  CHECK(udp->sent.size() == 1);
+  CHECK(udp->sent[0].size() == HEARTBEAT_HEADER_SIZE);
+  CHECK(udp->sent[0][3] == HEARTBEAT_TYPE_PROBE);
+  uint16_t sequence = udp->sent[0][4] | (udp->sent[0][5] << 8);
+  udp->incoming.push_back(datagram(1, HEARTBEAT_TYPE_BEAT, sequence, 1, ""));
+  udp->incoming.push_back(datagram(2, HEARTBEAT_TYPE_BEAT, 0, 1, ""));
+  udp->incoming.push_back(datagram(3, HEARTBEAT_TYPE_BEAT, sequence, 1, ""));
+  CHECK(heartbeat.handle() == 3);
+  CHECK(heartbeat.getSweepAnswerCount() == 2);
+}
+
+double elapsedNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Datagrams are queued the way they arrive between two loop iterations, at most one handle() worth
+void benchmark() {
+  registerAgents();
+  TestHeartbeat heartbeat(ingest);
+  WiFiUDP* udp = heartbeat.getUdp();
+  std::vector<std::vector<uint8_t> > packets;
+  for(int i = 0; i < AGENT_COUNT; i++) {
+    packets.push_back(datagram(i, HEARTBEAT_TYPE_BEAT, 0, 20000 + i, CUSTOM));
+  }
+  // Time spent queuing the datagrams is measured alone, and taken out
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for(int i = 0; i < BENCHMARK_HEARTBEATS; i++) {
+    udp->incoming.push_back(packets[i % AGENT_COUNT]);
+    if(udp->incoming.size() == HEARTBEAT_MAX_PER_HANDLE) {
+      udp->incoming.clear();
+    }
+  }
+  double queuingNs = elapsedNs(start);
+  start = std::chrono::steady_clock::now();
+  int processed = 0;
+  for(int i = 0; i < BENCHMARK_HEARTBEATS; i++) {
+    udp->incoming.push_back(packets[i % AGENT_COUNT]);
+    if(udp->incoming.size() == HEARTBEAT_MAX_PER_HANDLE) {
+      processed += heartbeat.handle();
+    }
+  }
+  double heartbeatNs = (elapsedNs(start) - queuingNs) / BENCHMARK_HEARTBEATS;
+  CHECK(processed == BENCHMARK_HEARTBEATS);
+  
+  // Same liveness data received as an HTTP ping response body
+  char custom[MAX_CUSTOM_DATA_SIZE + 1];
+  int responseSize = strlen(PING_RESPONSE);
+  start = std::chrono::steady_clock::now();
+  int complete = 0;
+  for(int i = 0; i < BENCHMARK_HEARTBEATS; i++) {
+    PingResponseScanner scanner(custom, MAX_CUSTOM_DATA_SIZE + 1);
+    scanner.write((const uint8_t*)PING_RESPONSE, responseSize);
+    complete += scanner.isComplete() ? 1 : 0;
+  }
+  double pingNs = elapsedNs(start) / BENCHMARK_HEARTBEATS;
+  CHECK(complete == BENCHMARK_HEARTBEATS);
+  
+  printf("Heartbeat: %.0f ns per heartbeat (%.0f heartbeats/s) for %d agents, "
+         "%.0f ns to scan the body of a ping response alone\n",
+         heartbeatNs, 1e9 / heartbeatNs, AGENT_COUNT, pingNs);
+}
+
+int main() {
+  testIngestion();
+  testSweep();
+  benchmark();
+  printf("Heartbeat: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+/**
+ *  Host benchmark of the latency of the requests served by the master module loop, with the former
+ *  fixed delay at the end of each iteration and with the sleep until the next deadline
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ *
+ *  Requests arrive at random times on the simulated clock; tasks take the simulated time given to
+ *  them, in the setup of the master module. Latency is from the arrival of a request until it's served.
+ */
+
+#include <algorithm>
+#include <vector>
+#include "LoopScheduler.h"
+
+#define SIMULATED_TIME 600000   // ms
+#define MEAN_REQUEST_PERIOD 200 // ms
+#define REQUEST_DURATION 3      // ms
+#define FIXED_DELAY 20          // ms, former delay at the end of each loop iteration
+#define LOOP_MAX_SLEEP 1000     // ms
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+unsigned long simulatedClock() {
+  return stubMillis;
+}
+
+std::vector<unsigned long> arrivals;
+unsigned int nextRequest;
+std::vector<unsigned long> latencies;
+
+// Serves the requests already arrived, one at a time like handleClient
+void serveRequests() {
+  if(nextRequest < arrivals.size() && arrivals[nextRequest] <= stubMillis) {
+    latencies.push_back(stubMillis - arrivals[nextRequest]);
+    nextRequest ++;
+    stubMillis += REQUEST_DURATION;
+  }
+}
+
+bool onIdle() {
+  serveRequests();
+  return false;
+}
+
+void idle() {}
+void refreshDisplay() { stubMillis += 2; }
+void timeDisplay() { stubMillis += 1; }
+void wifiDisplay() { stubMillis += 1; }
+void startSweep() { stubMillis += 40; }
+
+typedef struct {
+  unsigned long p50;
+  unsigned long p99;
+  unsigned long max;
+} latencyType;
+
+latencyType simulate(bool fixedDelay) {
+  stubMillis = 0;
+  srand(1);
+  arrivals.clear();
+  latencies.clear();
+  nextRequest = 0;
+  for(unsigned long time = rand() % (2 * MEAN_REQUEST_PERIOD); time < SIMULATED_TIME; time += rand() % (2 * MEAN_REQUEST_PERIOD)) {
+    arrivals.push_back(time);
+  }
+  // Same tasks and periods as the master module
+  LoopScheduler scheduler(simulatedClock);
+  scheduler.addPolling("web", serveRequests, PRIORITY_HIGH);
+  scheduler.addPolling("heartbeat", idle, PRIORITY_HIGH);
+  scheduler.addPolling("events", idle);
+  scheduler.addPolling("work", idle);
+  scheduler.addPeriodic("display", refreshDisplay, 50, PRIORITY_LOW);
+  scheduler.addPeriodic("time", timeDisplay, 1000, PRIORITY_LOW);
+  scheduler.addPeriodic("wifi", wifiDisplay, 3500, PRIORITY_LOW);
+  scheduler.addPeriodic("sweep", startSweep, 30000, PRIORITY_NORMAL, 100);
+  while(stubMillis < SIMULATED_TIME) {
+    scheduler.run();
+    if(fixedDelay) {
+      delay(FIXED_DELAY);
+    } else {
+      scheduler.sleep(LOOP_MAX_SLEEP, onIdle);
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  latencyType result;
+  result.p50 = latencies[latencies.size() / 2];
+  result.p99 = latencies[latencies.size() * 99 / 100];
+  result.max = latencies.back();
+  return result;
+}
+
+int main() {
+  latencyType before = simulate(true);
+  latencyType after = simulate(false);
+  printf("Request latency with delay(%d): p50 %lu ms, p99 %lu ms, max %lu ms\n", FIXED_DELAY, before.p50, before.p99, before.max);
+  printf("Request latency with the sleep until next deadline: p50 %lu ms, p99 %lu ms, max %lu ms\n", after.p50, after.p99, after.max);
+  CHECK(after.p50 < before.p50);
+  CHECK(after.p99 < before.p99);
+  // Requests only wait for a task already running: the longest is the sweep
+  CHECK(after.max <= 40 + REQUEST_DURATION);
+  printf("LoopLatency: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+/**
+ *  Host test of LoopScheduler, run with a simulated clock
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include <limits.h>
+#include "LoopScheduler.h"
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+// The simulated clock is the one of the Arduino stub: delay() advances it
+unsigned long simulatedClock() {
+  return stubMillis;
+}
+
+// Tasks append their letter to the run log, and take the simulated time set for them
+char runLog[50];
+unsigned long taskDurations[26];
+
+void logRun(char letter) {
+  int length = strlen(runLog);
+  runLog[length] = letter;
+  runLog[length + 1] = 0;
+  stubMillis += taskDurations[letter - 'a'];
+}
+void taskA() { logRun('a'); }
+void taskB() { logRun('b'); }
+void taskC() { logRun('c'); }
+void taskD() { logRun('d'); }
+
+void reset(unsigned long now) {
+  stubMillis = now;
+  runLog[0] = 0;
+  memset(taskDurations, 0, sizeof(taskDurations));
+}
+
+// Highest priority first, then in the order the tasks were added
+void testPriorityOrder() {
+  reset(1000);
+  LoopScheduler scheduler(simulatedClock);
+  scheduler.addPolling("a", taskA, PRIORITY_LOW);
+  scheduler.addPolling("b", taskB, PRIORITY_HIGH);
+  scheduler.addPolling("c", taskC);
+  scheduler.addPolling("d", taskD, PRIORITY_HIGH);
+  scheduler.run();
+  CHECK(strcmp(runLog, "bdca") == 0);
+}
+
+// Once the budget is spent, only high priority tasks run: the others stay due for next iteration
+void testLoopBudget() {
+  reset(1000);
+  LoopScheduler scheduler(simulatedClock);
+  scheduler.setLoopBudget(10);
+  scheduler.addPolling("a", taskA, PRIORITY_HIGH);
+  scheduler.addPolling("b", taskB, PRIORITY_HIGH);
+  scheduler.addPeriodic("c", taskC, 5);
+  scheduler.addPolling("d", taskD, PRIORITY_LOW);
+  taskDurations[0] = 15;
+  stubMillis += 5;
+  scheduler.run();
+  CHECK(strcmp(runLog, "ab") == 0);
+  runLog[0] = 0;
+  taskDurations[0] = 0;
+  scheduler.run();
+  CHECK(strcmp(runLog, "abcd") == 0);
+}
+
+// A finished one shot task frees its slot, which is reused by the next task added
+void testOneShotSlotReuse() {
+  reset(1000);
+  LoopScheduler scheduler(simulatedClock);
+  scheduler.addPeriodic("a", taskA, 100);
+  int oneShot = scheduler.addOneShot("b", taskB, 10);
+  scheduler.addPeriodic("c", taskC, 100);
+  CHECK(scheduler.getTaskCount() == 3);
+  stubMillis += 10;
+  scheduler.run();
+  CHECK(strcmp(runLog, "b") == 0);
+  CHECK(!scheduler.getTask(oneShot)->active);
+  stubMillis += 10;
+  scheduler.run();
+  CHECK(strcmp(runLog, "b") == 0);
+  CHECK(scheduler.addOneShot("d", taskD, 10) == oneShot);
+  CHECK(scheduler.getTaskCount() == 3);
+  stubMillis += 10;
+  scheduler.run();
+  CHECK(strcmp(runLog, "bd") == 0);
+  // d is done: its slot is free again, then no slot is free and a new one is taken
+  CHECK(scheduler.addPolling("a", taskA) == oneShot);
+  CHECK(scheduler.addPolling("c", taskC) == 3);
+  CHECK(scheduler.getTaskCount() == 4);
+}
+
+// Deadlines are computed with the signed difference: they survive the clock wrap around
+void testDeadlineAcrossClockWrap() {
+  reset(ULONG_MAX - 5);
+  LoopScheduler scheduler(simulatedClock);
+  CHECK(scheduler.timeToNextDeadline(1000) == 1000);
+  scheduler.addPolling("a", taskA);
+  CHECK(scheduler.timeToNextDeadline(1000) == 1000);
+  scheduler.addPeriodic("b", taskB, 20);
+  CHECK(scheduler.timeToNextDeadline(1000) == 20);
+  CHECK(scheduler.timeToNextDeadline(5) == 5);
+  stubMillis += 10;  // wrapped around: 4
+  CHECK(stubMillis == 4);
+  CHECK(scheduler.timeToNextDeadline(1000) == 10);
+  scheduler.run();
+  CHECK(strcmp(runLog, "a") == 0);
+  stubMillis += 10;
+  CHECK(scheduler.timeToNextDeadline(1000) == 0);
+  scheduler.run();
+  CHECK(strcmp(runLog, "aab") == 0);
+  CHECK(scheduler.timeToNextDeadline(1000) == 20);
+  // Sleeping waits for the next deadline
+  scheduler.sleep(1000);
+  CHECK(stubMillis == 34);
+  CHECK(scheduler.timeToNextDeadline(1000) == 0);
+}
+
+int main() {
+  testPriorityOrder();
+  testLoopBudget();
+  testOneShotSlotReuse();
+  testDeadlineAcrossClockWrap();
+  printf("LoopScheduler: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+/**
+ *  Host test of the partial saves of the master config, and of their write amplification,
+ *  on the flash emulator
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "masterConfig.h"
+#include "spi_flash.h"
+
+#define RENAMES 1000
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+// Gives access to the dirty ranges
+class TestConfig:public MasterConfigClass {
+public:
+  TestConfig():MasterConfigClass(CONFIG_VERSION, MODULE_NAME) {}
+  int getDirtyRangeCount() { return _dirtyRangeCount; }
+  dirtyRangeType* getDirtyRange(int i) { return &_dirtyRanges[i]; }
+  void clearDirty() { _dirtyRangeCount = 0; }
+  void setDirty(void* field, unsigned int size) { _setDirty(field, size); }
+  MasterConfigStruct* getData() { return _getDataPtr(); }
+  uint16_t offsetOf(void* field) { return (uint8_t*)field - (uint8_t*)_getDataPtr(); }
+  bool isRange(int i, void* start, void* end) {
+    return i < _dirtyRangeCount && _dirtyRanges[i].start == offsetOf(start) && _dirtyRanges[i].end == offsetOf(end);
+  }
+};
+
+// Like on the module, configs are never deleted: they are kept here, so as not to be reported as leaks
+TestConfig* configs[3];
+
+void testDirtyRangeMerging() {
+  stubFlashErase();
+  TestConfig& config = *(configs[0] = new TestConfig());
+  MasterConfigStruct* data = config.getData();
+  config.clearDirty();
+  
+  // Same field twice
+  config.setName("first");
+  config.setName("second");
+  CHECK(config.getDirtyRangeCount() == 1);
+  CHECK(config.isRange(0, data->name, data->name + sizeof(data->name)));
+  
+  // Contiguous fields
+  config.setHomeSsid("ssid");
+  config.setHomePwd("password");
+  CHECK(config.getDirtyRangeCount() == 2);
+  CHECK(config.isRange(1, data->homeSsid, data->homePwd + sizeof(data->homePwd)));
+  config.setGmtOffset(1, 30);
+  CHECK(config.getDirtyRangeCount() == 3);
+  CHECK(config.isRange(2, &data->gmtHourOffset, &data->gmtMinOffset + 1));
+  
+  // A range joining two others: they are merged into one
+  config.setDirty(data->name, data->homeSsid + 1 - data->name);
+  CHECK(config.getDirtyRangeCount() == 2);
+  CHECK(config.isRange(0, data->name, data->homePwd + sizeof(data->homePwd)));
+  CHECK(config.isRange(1, &data->gmtHourOffset, &data->gmtMinOffset + 1));
+  
+  // Too many ranges: they are all merged
+  config.clearDirty();
+  config.setName("third");
+  config.setApiKey("key");
+  config.setHomeSsid("ssid");
+  config.setApPwd("password");
+  CHECK(config.getDirtyRangeCount() == 4);
+  config.setGmtOffset(2, 0);
+  CHECK(config.getDirtyRangeCount() == 1);
+  CHECK(config.isRange(0, data->name, &data->gmtMinOffset + 1));
+}
+
+typedef struct {
+  unsigned long bytes;
+  unsigned long erases;
+} flashUseType;
+
+flashUseType flashUse() {
+  flashUseType use;
+  use.bytes = stubFlashBytesWritten;
+  use.erases = stubFlashEraseCount;
+  return use;
+}
+
+/**
+ * Renaming the master: the journal only writes the name, the whole data structure being written
+ * when it's compacted. Before, the whole data structure was saved to EEPROM, which is one sector
+ * erased and rewritten each time.
+ */
+void testWriteAmplification() {
+  char name[NAME_MAX_LENGTH + 1];
+  stubFlashErase();
+  TestConfig& config = *(configs[1] = new TestConfig());
+  config.init();
+  stubFlashResetCounters();
+  for(int i = 0; i < RENAMES; i++) {
+    sprintf(name, "iotinator%d", i);
+    config.setName(name);
+    config.requestSave();
+    CHECK(config.flush(true));
+    config.compactJournal();
+  }
+  flashUseType journal = flashUse();
+  uint32_t firstSector = (STUB_SPIFFS_END - 0x40200000) / SPI_FLASH_SEC_SIZE - CONFIG_JOURNAL_SECTORS;
+  unsigned long firstErases = stubFlashSectorEraseCount[firstSector];
+  unsigned long secondErases = stubFlashSectorEraseCount[firstSector + 1];
+  
+  // The last name is read back from flash
+  TestConfig& loaded = *(configs[2] = new TestConfig());
+  loaded.init();
+  CHECK(strcmp(loaded.getName(), name) == 0);
+  
+  stubFlashResetCounters();
+  for(int i = 0; i < RENAMES; i++) {
+    sprintf(name, "iotinator%d", i);
+    config.setName(name);
+    config.XEEPROMConfigClass::saveToEeprom();
+  }
+  flashUseType eeprom = flashUse();
+  
+  int nameSize = sizeof(config.getData()->name);
+  printf("Config of %d bytes, %d renames: journal %lu bytes written and %lu erases (%lu + %lu per sector), "
+         "whole data structure %lu bytes and %lu erases. Write amplification %.1f instead of %.1f\n",
+         (int)sizeof(MasterConfigStruct), RENAMES, journal.bytes, journal.erases, firstErases, secondErases,
+         eeprom.bytes, eeprom.erases, (double)journal.bytes / RENAMES / nameSize, (double)eeprom.bytes / RENAMES / nameSize);
+  CHECK(eeprom.erases == RENAMES);
+  CHECK(journal.erases * 20 < RENAMES);
+  CHECK(journal.bytes * 4 < eeprom.bytes);
+  // Compactions alternate between the sectors
+  CHECK(firstErases + secondErases == journal.erases);
+  CHECK(firstErases - secondErases + 1 <= 2);
+}
+
+int main() {
+  testDirtyRangeMerging();
+  testWriteAmplification();
+  printf("MasterConfig: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/**
+ *  Fuzz target for PingResponseScanner, the in place scanner of agent ping responses
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ *
+ *  Built with libFuzzer (make fuzz), it's a regular fuzz target. Otherwise (make test), a main
+ *  checks known responses, then feeds random and mutated inputs to the same target.
+ *  Both builds run under AddressSanitizer and UndefinedBehaviorSanitizer.
+ */
+
+#include <assert.h>
+#include "PingResponseScanner.h"
+
+#define CUSTOM_MAX_SIZE 32
+#define GUARD_SIZE 8
+#define GUARD_VALUE 0xA5
+
+/**
+ * Scan the input byte by byte and in one write, and check that:
+ * - nothing is written outside the custom storage
+ * - custom is null terminated, and its size is the reported one
+ * - both ways of feeding the scanner give the same result
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  uint8_t storage[2][GUARD_SIZE + CUSTOM_MAX_SIZE + GUARD_SIZE];
+  PingResponseScanner* scanners[2];
+  for(int i = 0; i < 2; i++) {
+    memset(storage[i], GUARD_VALUE, sizeof(storage[i]));
+    storage[i][GUARD_SIZE] = 0;
+    scanners[i] = new PingResponseScanner((char*)storage[i] + GUARD_SIZE, CUSTOM_MAX_SIZE);
+  }
+  for(size_t i = 0; i < size; i++) {
+    scanners[0]->write(data[i]);
+  }
+  scanners[1]->write(data, size);
+  
+  for(int i = 0; i < 2; i++) {
+    char* custom = (char*)storage[i] + GUARD_SIZE;
+    for(int j = 0; j < GUARD_SIZE; j++) {
+      assert(storage[i][j] == GUARD_VALUE);
+      assert(storage[i][GUARD_SIZE + CUSTOM_MAX_SIZE + j] == GUARD_VALUE);
+    }
+    assert(scanners[i]->getCustomSize() < CUSTOM_MAX_SIZE);
+    if(scanners[i]->isCustomFound()) {
+      assert(custom[scanners[i]->getCustomSize()] == 0);
+    }
+  }
+  assert(scanners[0]->isComplete() == scanners[1]->isComplete());
+  assert(scanners[0]->getHeap() == scanners[1]->getHeap());
+  assert(scanners[0]->isCustomFound() == scanners[1]->isCustomFound());
+  assert(scanners[0]->isCustomTooBig() == scanners[1]->isCustomTooBig());
+  assert(memcmp(storage[0], storage[1], sizeof(storage[0])) == 0);
+  for(int i = 0; i < 2; i++) {
+    delete scanners[i];
+  }
+  return 0;
+}
+
+#ifndef LIBFUZZER
+
+#define RANDOM_ITERATIONS 200000
+#define INPUT_MAX_SIZE 96
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+void checkResponse(const char* response, bool complete, uint32_t heap, const char* custom, bool tooBig = false) {
+  char storage[CUSTOM_MAX_SIZE];
+  strcpy(storage, "unchanged");
+  PingResponseScanner scanner(storage, CUSTOM_MAX_SIZE);
+  scanner.write((const uint8_t*)response, strlen(response));
+  LLVMFuzzerTestOneInput((const uint8_t*)response, strlen(response));
+  CHECK(scanner.isComplete() == complete);
+  if(!complete) return;
+  CHECK(scanner.getHeap() == heap);
+  CHECK(scanner.isCustomFound() == (custom != NULL));
+  CHECK(strcmp(storage, custom != NULL ? custom : "unchanged") == 0);
+  CHECK(scanner.isCustomTooBig() == tooBig);
+}
+
+// Pieces of ping responses, so that random inputs are mostly almost valid json
+const char* tokens[] = {"{", "}", "[", "]", "\"", "\\", ":", ",", " ", "\"heap\"", "\"custom\"", "\"other\"",
+                        "123", "-4", "1.5e3", "true", "null", "\\u00e9", "\\u20ac", "\\n", "\\\"", "abc"};
+
+int main() {
+  checkResponse("{\"heap\":21560,\"custom\":\"{\\\"on\\\":true}\"}", true, 21560, "{\"on\":true}");
+  checkResponse(" { \"custom\" : \"a\\tb\" , \"heap\" : 12 } ", true, 12, "a\tb");
+  checkResponse("{\"heap\":100}", true, 100, NULL);
+  checkResponse("{\"custom\":null,\"heap\":1}", true, 1, "");
+  checkResponse("{\"custom\":\"\\u00e9\\u20ac\"}", true, 0, "\xC3\xA9\xE2\x82\xAC");
+  checkResponse("{\"other\":{\"heap\":5,\"x\":[1,\"}\"]},\"heap\":7}", true, 7, NULL);
+  checkResponse("{\"averyveryverylongkey\":1,\"heap\":3}", true, 3, NULL);
+  checkResponse("{\"custom\":\"0123456789012345678901234567890123456789\"}", true, 0,
+                "0123456789012345678901234567890", true);
+  checkResponse("{\"heap\":1", false, 0, NULL);
+  checkResponse("{\"heap\" 1}", false, 0, NULL);
+  checkResponse("{\"heap\":1} x", false, 0, NULL);
+  checkResponse("{\"custom\":\"\\uZZZZ\"}", false, 0, NULL);
+  
+  srand(1);
+  uint8_t input[INPUT_MAX_SIZE];
+  for(int i = 0; i < RANDOM_ITERATIONS; i++) {
+    int size = 0;
+    int target = rand() % INPUT_MAX_SIZE;
+    while(size < target) {
+      if(rand() % 4 == 0) {
+        input[size++] = rand() % 256;
+      } else {
+        const char* token = tokens[rand() % (sizeof(tokens) / sizeof(tokens[0]))];
+        int length = strlen(token);
+        if(size + length > target) break;
+        memcpy(input + size, token, length);
+        size += length;
+      }
+    }
+    LLVMFuzzerTestOneInput(input, size);
+  }
+  printf("PingResponseScanner: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ *  Simulation of a registration storm: a swarm of agents registering at once to the master,
+ *  with the delays given by RegistrationPacer
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include <queue>
+#include <vector>
+#include "RegistrationPacer.h"
+
+#define AGENT_COUNT 100
+// Agents all boot within this time (ms)
+#define ARRIVAL_SPREAD 1000
+// Time the master takes to answer (ms): registrations are processed, deferred ones only answered
+#define REGISTRATION_DURATION 150
+#define DEFERRAL_DURATION 5
+#define NETWORK_JITTER 20
+// No second should see more registrations than what the slots allow, plus the storm threshold
+#define MAX_REGISTRATIONS_PER_SECOND (1000 / REGISTRATION_SLOT_SPACING + REGISTRATION_STORM_THRESHOLD + 1)
+#define MAX_ATTEMPTS_PER_SECOND 15
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+typedef struct {
+  unsigned long time;
+  int agent;
+} attemptType;
+
+struct LaterFirst {
+  bool operator()(const attemptType& a, const attemptType& b) { return a.time > b.time; }
+};
+
+/**
+ * Registration attempts are served one at a time by the master, in the order they arrive.
+ * Returns the time when all agents are registered.
+ */
+unsigned long simulate(const char* name, unsigned long notBefore) {
+  RegistrationPacer pacer;
+  std::priority_queue<attemptType, std::vector<attemptType>, LaterFirst> attempts;
+  srand(1);
+  for(int i = 0; i < AGENT_COUNT; i++) {
+    attempts.push({(unsigned long)(rand() % ARRIVAL_SPREAD), i});
+  }
+  std::vector<int> registrationsPerSecond;
+  std::vector<int> attemptsPerSecond;
+  unsigned long busyUntil = 0;
+  unsigned long maxWait = 0;
+  int registered = 0;
+  int attemptCount = 0;
+  while(!attempts.empty()) {
+    attemptType attempt = attempts.top();
+    attempts.pop();
+    stubMillis = attempt.time > busyUntil ? attempt.time : busyUntil;
+    if(stubMillis - attempt.time > maxWait) {
+      maxWait = stubMillis - attempt.time;
+    }
+    unsigned int second = stubMillis / 1000;
+    if(second >= attemptsPerSecond.size()) {
+      attemptsPerSecond.resize(second + 1);
+      registrationsPerSecond.resize(second + 1);
+    }
+    attemptsPerSecond[second] ++;
+    attemptCount ++;
+    uint32_t ip = 0x0A0A0A00 + attempt.agent + 2;
+    unsigned long retryAfter = pacer.admit(ip, notBefore);
+    if(retryAfter == 0) {
+      busyUntil = stubMillis + REGISTRATION_DURATION;
+      registrationsPerSecond[second] ++;
+      registered ++;
+    } else {
+      busyUntil = stubMillis + DEFERRAL_DURATION;
+      attempts.push({busyUntil + retryAfter + rand() % NETWORK_JITTER, attempt.agent});
+    }
+  }
+  int maxRegistrations = 0;
+  int maxAttempts = 0;
+  for(unsigned int i = 0; i < attemptsPerSecond.size(); i++) {
+    maxRegistrations = registrationsPerSecond[i] > maxRegistrations ? registrationsPerSecond[i] : maxRegistrations;
+    // The first second is the initial burst of agents booting, only the retries are paced
+    if(i > ARRIVAL_SPREAD / 1000) {
+      maxAttempts = attemptsPerSecond[i] > maxAttempts ? attemptsPerSecond[i] : maxAttempts;
+    }
+  }
+  printf("%s: %d agents registered in %lu ms, %d attempts, at most %d registrations and %d retries per second, "
+         "longest wait for the master %lu ms\n",
+         name, registered, busyUntil, attemptCount, maxRegistrations, maxAttempts, maxWait);
+  CHECK(registered == AGENT_COUNT);
+  CHECK(maxRegistrations <= MAX_REGISTRATIONS_PER_SECOND);
+  // Deferred agents don't come back all at once
+  CHECK(maxAttempts <= MAX_ATTEMPTS_PER_SECOND);
+  CHECK(maxWait < 2 * REGISTRATION_DURATION * MAX_REGISTRATIONS_PER_SECOND);
+  return busyUntil;
+}
+
+int main() {
+  // Master starting with all its agents: they register at once
+  unsigned long duration = simulate("Storm", 0);
+  // Slots are spaced enough for a registration: the swarm is registered about as fast as the slots go
+  CHECK(duration < (AGENT_COUNT + REGISTRATION_MAX_SLOTS) * REGISTRATION_SLOT_SPACING + ARRIVAL_SPREAD);
+  // Agents on the default Access Point, told to come back after the switch to the custom one,
+  // later than the longest delay: they are spread instead of all coming back at the same time
+  simulate("Access Point switch", REGISTRATION_MAX_DELAY + 10000);
+  printf("RegistrationPacer: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
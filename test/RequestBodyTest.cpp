@@ -0,0 +1,39 @@
+/**
+ *  Host test of RequestBody: handlers parse a copy of the body, the web server's one is untouched
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "RequestBody.h"
+
+int failures = 0;
+
+#define CHECK(condition) if(!(condition)) { printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); failures ++; }
+
+void checkCopy(unsigned int length) {
+  std::string content(length, 'a');
+  String serverBody(content.c_str());
+  RequestBody body(serverBody);
+  CHECK(body.get() != NULL);
+  CHECK(!body.isTooBig());
+  if(body.get() == NULL) return;
+  CHECK(strcmp(body.get(), serverBody.c_str()) == 0);
+  // What the parser writes stays in the copy
+  body.get()[0] = 0;
+  CHECK(serverBody.c_str() != body.get());
+  CHECK(serverBody.length() == length && (length == 0 || serverBody.c_str()[0] == 'a'));
+}
+
+int main() {
+  checkCopy(0);
+  checkCopy(REQUEST_BODY_STACK_SIZE - 1);  // biggest on the stack
+  checkCopy(REQUEST_BODY_STACK_SIZE);      // on the heap
+  checkCopy(REQUEST_BODY_MAX_SIZE - 1);
+  
+  std::string content(REQUEST_BODY_MAX_SIZE, 'a');
+  RequestBody tooBig(String(content.c_str()));
+  CHECK(tooBig.get() == NULL);
+  CHECK(tooBig.isTooBig());
+  printf("RequestBody: %d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+/**
+ *  Minimal host replacement of the Arduino core, for the host tests of the master module
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "Arduino.h"
+
+unsigned long stubMillis = 0;
+HardwareSerialStub Serial;
+EspStub ESP;
+
+unsigned long millis() {
+  return stubMillis;
+}
+
+void delay(unsigned long ms) {
+  stubMillis += ms;
+}
+
+// Output is only useful when debugging a test: it's dropped unless TEST_VERBOSE is set
+void HardwareSerialStub::printf(const char* format, ...) {
+  if(getenv("TEST_VERBOSE") == NULL) return;
+  va_list args;
+  va_start(args, format);
+  vprintf(format, args);
+  va_end(args);
+}
+
+void HardwareSerialStub::print(const char* message) {
+  printf("%s", message);
+}
+
+void HardwareSerialStub::println(const char* message) {
+  printf("%s\n", message);
+}
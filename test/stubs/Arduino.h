@@ -0,0 +1,73 @@
+/**
+ *  Minimal host replacement of the Arduino core, for the host tests of the master module
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+
+// Simulated time: millis() returns it, delay() advances it
+extern unsigned long stubMillis;
+unsigned long millis();
+void delay(unsigned long ms);
+
+template<typename T, typename U> T min(T a, U b) { return a < (T)b ? a : (T)b; }
+
+class String {
+public:
+  String(const char* value = "") : _value(value) {}
+  const char* c_str() const { return _value.c_str(); }
+  unsigned int length() const { return _value.size(); }
+  void toCharArray(char* buffer, unsigned int size) const {
+    strncpy(buffer, _value.c_str(), size);
+    buffer[size - 1] = 0;
+  }
+protected:
+  std::string _value;
+};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *data, size_t size) {
+    size_t n = 0;
+    while(size--) n += write(*data++);
+    return n;
+  }
+};
+
+class Stream:public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+};
+
+class HardwareSerialStub {
+public:
+  void printf(const char* format, ...);
+  void print(const char* message);
+  void println(const char* message);
+};
+extern HardwareSerialStub Serial;
+
+class EspStub {
+public:
+  uint32_t getCycleCount() { return (uint32_t)(stubMillis * 80000); }
+  uint8_t getCpuFreqMHz() { return 80; }
+  uint32_t getFreeHeap() { return 40000; }
+  // Emulated flash, see spi_flash.h
+  bool flashEraseSector(uint32_t sector);
+  bool flashWrite(uint32_t address, uint32_t* data, size_t size);
+  bool flashRead(uint32_t address, uint32_t* data, size_t size);
+};
+extern EspStub ESP;
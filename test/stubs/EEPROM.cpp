@@ -0,0 +1,39 @@
+/**
+ *  Minimal host replacement of the ESP8266 EEPROM library, on the flash emulator
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "EEPROM.h"
+
+EEPROMClass EEPROM;
+
+uint32_t EEPROMClass::_sector() {
+  return (STUB_SPIFFS_END - 0x40200000) / SPI_FLASH_SEC_SIZE;
+}
+
+void EEPROMClass::begin(size_t size) {
+  _size = (size + 3) & ~3;
+  ESP.flashRead(_sector() * SPI_FLASH_SEC_SIZE, (uint32_t*)_data, _size);
+  _dirty = false;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  if(_data[address] != value) {
+    _data[address] = value;
+    _dirty = true;
+  }
+}
+
+bool EEPROMClass::commit() {
+  if(!_dirty) return true;
+  if(!ESP.flashEraseSector(_sector())) return false;
+  if(!ESP.flashWrite(_sector() * SPI_FLASH_SEC_SIZE, (uint32_t*)_data, _size)) return false;
+  _dirty = false;
+  return true;
+}
+
+void EEPROMClass::end() {
+  commit();
+  _size = 0;
+}
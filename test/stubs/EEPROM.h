@@ -0,0 +1,26 @@
+/**
+ *  Minimal host replacement of the ESP8266 EEPROM library, on the flash emulator: the EEPROM is
+ *  the sector following the SPIFFS area, erased and rewritten as a whole on each commit.
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "spi_flash.h"
+
+class EEPROMClass {
+public:
+  void begin(size_t size);
+  uint8_t read(int address) { return _data[address]; }
+  void write(int address, uint8_t value);
+  bool commit();
+  void end();
+  
+protected:
+  uint8_t _data[SPI_FLASH_SEC_SIZE];
+  size_t _size = 0;
+  bool _dirty = false;
+  uint32_t _sector();
+};
+extern EEPROMClass EEPROM;
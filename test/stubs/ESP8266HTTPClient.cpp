@@ -0,0 +1,12 @@
+/**
+ *  Minimal host replacement of HTTPClient, talking to simulated agents over a simulated network
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "ESP8266HTTPClient.h"
+
+unsigned long stubConnectTime = 0;
+unsigned long stubExchangeTime = 0;
+unsigned long stubConnectCount = 0;
+const char* stubAgentResponse = "{}";
@@ -0,0 +1,60 @@
+/**
+ *  Minimal host replacement of HTTPClient, talking to simulated agents over a simulated network:
+ *  each exchange advances the simulated clock of the Arduino stub.
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// Simulated network, set by the test: durations in ms, and what agents answer
+extern unsigned long stubConnectTime;     // TCP handshake
+extern unsigned long stubExchangeTime;    // request sent, processed by the agent, response received
+extern unsigned long stubConnectCount;    // connections opened so far
+extern const char* stubAgentResponse;
+
+class HTTPClient {
+public:
+  bool begin(const char* host, uint16_t port, const char* uri) {
+    // A kept-alive connection is only reused for the same host
+    if(_connected && strcmp(_host, host) != 0) {
+      _connected = false;
+    }
+    strncpy(_host, host, sizeof(_host) - 1);
+    _host[sizeof(_host) - 1] = 0;
+    return true;
+  }
+  void setReuse(bool reuse) { _reuse = reuse; }
+  void setTimeout(uint16_t timeout) {}
+  void addHeader(const char* name, const char* value) {}
+  int GET() { return sendRequest("GET", NULL, 0); }
+  int POST(uint8_t* payload, size_t size) { return sendRequest("POST", payload, size); }
+  int sendRequest(const char* type, uint8_t* payload, size_t size) {
+    if(!_connected) {
+      stubMillis += stubConnectTime;
+      stubConnectCount ++;
+      _connected = true;
+    }
+    stubMillis += stubExchangeTime;
+    return 200;
+  }
+  int writeToStream(Stream* stream) {
+    if(stream != NULL) {
+      stream->write((const uint8_t*)stubAgentResponse, strlen(stubAgentResponse));
+    }
+    return strlen(stubAgentResponse);
+  }
+  void end() {
+    if(!_reuse) {
+      _connected = false;
+    }
+  }
+  bool connected() { return _connected; }
+  static String errorToString(int error) { return String("error"); }
+  
+protected:
+  char _host[32] = "";
+  bool _reuse = false;
+  bool _connected = false;
+};
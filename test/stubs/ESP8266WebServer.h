@@ -0,0 +1,37 @@
+/**
+ *  Minimal host replacement of ESP8266WebServer: the request being served is set by the test,
+ *  the response is recorded
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+
+class ESP8266WebServer {
+public:
+  HTTPMethod method() { return requestMethod; }
+  const String& uri() { return requestUri; }
+  const String& arg(const char* name) { return requestBody; }
+  void setContentLength(size_t length) { _contentLength = length; }
+  void send(int code, const char* contentType, const char* content) {
+    responseCode = code;
+    response = content;
+  }
+  void sendHeader(const char* name, const char* value) {}
+  void sendContent(const String& content) { response += content.c_str(); }
+  void sendContent_P(const char* content, size_t size) { response.append(content, size); }
+  
+  HTTPMethod requestMethod = HTTP_GET;
+  String requestUri;
+  String requestBody;
+  int responseCode = 0;
+  std::string response;
+  
+protected:
+  size_t _contentLength = 0;
+};
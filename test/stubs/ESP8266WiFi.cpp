@@ -0,0 +1,9 @@
+/**
+ *  Minimal host replacement of the ESP8266 WiFi library: the Access Point addresses
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "ESP8266WiFi.h"
+
+WiFiStub WiFi;
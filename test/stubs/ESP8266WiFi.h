@@ -0,0 +1,30 @@
+/**
+ *  Minimal host replacement of the ESP8266 WiFi library: the Access Point addresses
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+class IPAddress {
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) {
+    _bytes[0] = a; _bytes[1] = b; _bytes[2] = c; _bytes[3] = d;
+  }
+  uint8_t operator[](int index) const { return _bytes[index]; }
+  
+protected:
+  uint8_t _bytes[4];
+};
+
+class WiFiStub {
+public:
+  uint8_t* softAPmacAddress(uint8_t* mac) {
+    static const uint8_t apMac[6] = {0x5e, 0xcf, 0x7f, 0x00, 0x00, 0x01};
+    memcpy(mac, apMac, 6);
+    return mac;
+  }
+  IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+};
+extern WiFiStub WiFi;
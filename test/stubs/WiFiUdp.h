@@ -0,0 +1,41 @@
+/**
+ *  Minimal host replacement of WiFiUDP: datagrams are queued by the test instead of received
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <deque>
+#include <vector>
+
+class WiFiUDP {
+public:
+  uint8_t begin(uint16_t port) { return 1; }
+  // Returns the size of the next queued datagram, 0 if none
+  int parsePacket() {
+    if(incoming.empty()) return 0;
+    _current = incoming.front();
+    incoming.pop_front();
+    _position = 0;
+    return _current.size();
+  }
+  int read(uint8_t* buffer, size_t size) {
+    size_t count = _current.size() - _position < size ? _current.size() - _position : size;
+    memcpy(buffer, _current.data() + _position, count);
+    _position += count;
+    return count;
+  }
+  void flush() { _position = _current.size(); }
+  int beginPacket(IPAddress ip, uint16_t port) { sent.push_back(std::vector<uint8_t>()); return 1; }
+  size_t write(const uint8_t* buffer, size_t size) { sent.back().insert(sent.back().end(), buffer, buffer + size); return size; }
+  int endPacket() { return 1; }
+  
+  std::deque<std::vector<uint8_t> > incoming;
+  std::vector<std::vector<uint8_t> > sent;
+  
+protected:
+  std::vector<uint8_t> _current;
+  size_t _position = 0;
+};
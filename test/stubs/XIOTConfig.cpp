@@ -0,0 +1,48 @@
+/**
+ *  Minimal host replacement of the XIOTConfig and XEEPROMConfig libraries
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "XIOTConfig.h"
+#include "EEPROM.h"
+
+XEEPROMConfigClass::XEEPROMConfigClass(unsigned int version, const char* type, unsigned int dataSize) {
+  _version = version;
+  strncpy(_type, type, CONFIG_TYPE_MAX_LENGTH);
+  _type[CONFIG_TYPE_MAX_LENGTH] = 0;
+  _dataSize = dataSize;
+  _data = (uint8_t*)calloc(dataSize, 1);
+}
+
+// Read the data structure from EEPROM, default values are used if it was saved by another version
+void XEEPROMConfigClass::init() {
+  EEPROM.begin(_dataSize);
+  for(unsigned int i = 0; i < _dataSize; i++) {
+    _data[i] = EEPROM.read(i);
+  }
+  EEPROM.end();
+  XEEPROMConfigDataStruct* data = (XEEPROMConfigDataStruct*)_data;
+  if(data->version != _version || strcmp(data->type, _type) != 0) {
+    initFromDefault();
+  }
+}
+
+void XEEPROMConfigClass::initFromDefault() {
+  XEEPROMConfigDataStruct* data = (XEEPROMConfigDataStruct*)_data;
+  data->version = _version;
+  strcpy(data->type, _type);
+}
+
+// The whole data structure is written
+void XEEPROMConfigClass::saveToEeprom() {
+  EEPROM.begin(_dataSize);
+  for(unsigned int i = 0; i < _dataSize; i++) {
+    EEPROM.write(i, _data[i]);
+  }
+  EEPROM.end();
+}
+
+uint8_t* XEEPROMConfigClass::_getDataPtr() {
+  return _data;
+}
@@ -0,0 +1,39 @@
+/**
+ *  Minimal host replacement of the XIOTConfig and XEEPROMConfig libraries: the config data structure
+ *  is read from and saved to the EEPROM as a whole
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+// Stand-ins for the library's limits and defaults
+#define NAME_MAX_LENGTH 20
+#define SSID_MAX_LENGTH 32
+#define PWD_MAX_LENGTH 50
+#define DEFAULT_APSSID "iotinator"
+#define DEFAULT_APPWD "iotinator"
+#define DEFAULT_AP_EXPOSITION 60000
+#define CONFIG_TYPE_MAX_LENGTH 10
+
+struct XEEPROMConfigDataStruct {
+  unsigned int version;
+  char type[CONFIG_TYPE_MAX_LENGTH + 1];
+};
+
+class XEEPROMConfigClass {
+public:
+  XEEPROMConfigClass(unsigned int version, const char* type, unsigned int dataSize);
+  virtual ~XEEPROMConfigClass() {}
+  void init(void);
+  virtual void initFromDefault(void);
+  void saveToEeprom(void);
+  
+protected:
+  unsigned int _version;
+  char _type[CONFIG_TYPE_MAX_LENGTH + 1];
+  unsigned int _dataSize;
+  uint8_t* _data;
+  uint8_t* _getDataPtr(void);
+};
@@ -0,0 +1,30 @@
+/**
+ *  Minimal host replacement of the XIOTModule library: only what the tested classes use
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "XIOTModule.h"
+#include "ESP8266HTTPClient.h"
+
+void XIOTModule::APIGet(const char* ip, const char* path, int* httpCode, char* response, int maxSize) {
+  HTTPClient http;
+  http.begin(ip, 80, path);
+  *httpCode = http.GET();
+  if(response != NULL && maxSize > 0) {
+    strncpy(response, stubAgentResponse, maxSize - 1);
+    response[maxSize - 1] = 0;
+  }
+  http.end();
+}
+
+void XIOTModule::APIPost(const char* ip, const char* path, const char* body, int* httpCode, char* response, int maxSize) {
+  HTTPClient http;
+  http.begin(ip, 80, path);
+  *httpCode = http.POST((uint8_t*)body, strlen(body));
+  if(response != NULL && maxSize > 0) {
+    strncpy(response, stubAgentResponse, maxSize - 1);
+    response[maxSize - 1] = 0;
+  }
+  http.end();
+}
@@ -0,0 +1,29 @@
+/**
+ *  Minimal host replacement of the XIOTModule library: only what the tested classes use
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+
+// Stand-ins for the library's limits
+#define MAX_CUSTOM_DATA_SIZE 200
+#define MAC_ADDR_MAX_LENGTH 17
+
+namespace XIOTModuleJsonTag {
+  static const char* const heap = "heap";
+  static const char* const custom = "custom";
+}
+
+// Requests to agents open a new connection each time, through the simulated network of the HTTPClient stub
+class XIOTModule {
+public:
+  ESP8266WebServer* getServer() { return &server; }
+  void sendJson(const char* json, int code) { server.send(code, "application/json", json); }
+  void APIGet(const char* ip, const char* path, int* httpCode, char* response, int maxSize);
+  void APIPost(const char* ip, const char* path, const char* body, int* httpCode, char* response, int maxSize);
+  
+  ESP8266WebServer server;
+};
@@ -0,0 +1,17 @@
+/**
+ *  Minimal host replacement of the XUtils library: only what the tested classes use
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+#pragma once
+
+#include <Arduino.h>
+
+class XUtils {
+public:
+  // Copies at most maxLength characters, always null terminated
+  static void safeStringCopy(char* dest, const char* src, int maxLength) {
+    strncpy(dest, src, maxLength);
+    dest[maxLength] = 0;
+  }
+};
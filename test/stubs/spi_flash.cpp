@@ -0,0 +1,78 @@
+/**
+ *  Host flash emulator, behind the ESP flash API of the Arduino stub
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ */
+
+#include "spi_flash.h"
+
+// Addresses of the SPIFFS area, in the flash mapped memory, set by the linker script on the module
+asm(".globl _SPIFFS_start\n.set _SPIFFS_start, 0x40280000");
+asm(".globl _SPIFFS_end\n.set _SPIFFS_end, 0x402FB000");
+
+static uint8_t flash[STUB_FLASH_SIZE];
+static bool poweredOff = false;
+unsigned long stubFlashBytesRead = 0;
+unsigned long stubFlashBytesWritten = 0;
+unsigned long stubFlashEraseCount = 0;
+unsigned long stubFlashSectorEraseCount[STUB_FLASH_SIZE / SPI_FLASH_SEC_SIZE];
+long stubFlashPowerCutAfter = STUB_FLASH_NO_POWER_CUT;
+
+void stubFlashErase() {
+  memset(flash, 0xFF, STUB_FLASH_SIZE);
+  stubFlashResetCounters();
+  stubFlashReboot();
+}
+
+void stubFlashResetCounters() {
+  stubFlashBytesRead = 0;
+  stubFlashBytesWritten = 0;
+  stubFlashEraseCount = 0;
+  memset(stubFlashSectorEraseCount, 0, sizeof(stubFlashSectorEraseCount));
+}
+
+void stubFlashReboot() {
+  poweredOff = false;
+  stubFlashPowerCutAfter = STUB_FLASH_NO_POWER_CUT;
+}
+
+static bool isValid(uint32_t address, size_t size) {
+  return (address & 3) == 0 && (size & 3) == 0 && address + size <= STUB_FLASH_SIZE;
+}
+
+// An erase interrupted by a power cut leaves the sector in an unknown state: it's left as it was
+bool EspStub::flashEraseSector(uint32_t sector) {
+  if(poweredOff || stubFlashPowerCutAfter == 0) {
+    poweredOff = true;
+    return false;
+  }
+  if(sector >= STUB_FLASH_SIZE / SPI_FLASH_SEC_SIZE) return false;
+  memset(flash + sector * SPI_FLASH_SEC_SIZE, 0xFF, SPI_FLASH_SEC_SIZE);
+  stubFlashEraseCount ++;
+  stubFlashSectorEraseCount[sector] ++;
+  return true;
+}
+
+bool EspStub::flashWrite(uint32_t address, uint32_t* data, size_t size) {
+  if(poweredOff || !isValid(address, size)) return false;
+  const uint8_t* bytes = (const uint8_t*)data;
+  for(size_t i = 0; i < size; i++) {
+    if(stubFlashPowerCutAfter == 0) {
+      poweredOff = true;
+      return false;
+    }
+    if(stubFlashPowerCutAfter > 0) {
+      stubFlashPowerCutAfter --;
+    }
+    flash[address + i] &= bytes[i];
+    stubFlashBytesWritten ++;
+  }
+  return true;
+}
+
+bool EspStub::flashRead(uint32_t address, uint32_t* data, size_t size) {
+  if(!isValid(address, size)) return false;
+  memcpy(data, flash + address, size);
+  stubFlashBytesRead += size;
+  return true;
+}
@@ -0,0 +1,30 @@
+/**
+ *  Host flash emulator, behind the ESP flash API of the Arduino stub
+ *  Xavier Grosjean 2018
+ *  Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International Public License
+ *
+ *  Like NOR flash, erasing sets the bytes of a sector to 0xFF and writing can only clear bits.
+ *  Addresses and sizes must be 4 bytes aligned. A power cut can be set after a number of bytes
+ *  written: the write in progress stops there, and the flash can't be erased nor written anymore
+ *  until stubFlashReboot().
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define SPI_FLASH_SEC_SIZE 4096
+// 1MB flash, with the SPIFFS area ending at the EEPROM sector, as declared in the stub linker symbols
+#define STUB_FLASH_SIZE 0x100000
+#define STUB_SPIFFS_START 0x40280000
+#define STUB_SPIFFS_END 0x402FB000
+#define STUB_FLASH_NO_POWER_CUT -1
+
+extern unsigned long stubFlashBytesRead;
+extern unsigned long stubFlashBytesWritten;
+extern unsigned long stubFlashEraseCount;
+extern unsigned long stubFlashSectorEraseCount[STUB_FLASH_SIZE / SPI_FLASH_SEC_SIZE];
+extern long stubFlashPowerCutAfter;  // bytes that can still be written, STUB_FLASH_NO_POWER_CUT if no cut is set
+
+void stubFlashErase();         // whole flash, and counters reset
+void stubFlashResetCounters();
+void stubFlashReboot();        // power is back: flash can be written again